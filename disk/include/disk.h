@@ -5,6 +5,8 @@ int init_disk(char *filename, int ncyl, int nsec, int ttd);
 int cmd_i(int *ncyl, int *nsec);
 int cmd_r(int cyl, int sec, char *buf);
 int cmd_w(int cyl, int sec, int len, char *data);
+int cmd_wm(int cyl, int sec, int nblocks, char *data);
+int cmd_rm(int cyl, int sec, int nblocks, char *buf);
 void close_disk();
 
 #endif
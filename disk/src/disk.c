@@ -137,6 +137,65 @@ int cmd_w(int cyl, int sec, int len, char *data)
     return 0;
 }
 
+// write nblocks consecutive sectors starting at (cyl, sec), crossing cylinders if needed
+int cmd_wm(int cyl, int sec, int nblocks, char *data)
+{
+    if (cyl >= _ncyl || sec >= _nsec || cyl < 0 || sec < 0)
+    {
+        Log("Invalid cylinder or sector");
+        return 1;
+    }
+    if (data == NULL)
+    {
+        Log("Data is NULL");
+        return 1;
+    }
+    long first = (long)cyl * _nsec + sec;
+    if (nblocks <= 0 || first + nblocks > (long)_ncyl * _nsec)
+    {
+        Log("Invalid block count %d", nblocks);
+        return 1;
+    }
+    // seek to the first cylinder, then one track step per cylinder crossed
+    int last_cyl = (first + nblocks - 1) / _nsec;
+    int delay = abs(cyl - cur_cyl) * _ttd + (last_cyl - cyl) * _ttd;
+    usleep(delay * 1000);
+
+    memcpy(diskfile + first * BLOCKSIZE, data, (long)nblocks * BLOCKSIZE);
+    cur_cyl = last_cyl;
+    Log("Wrote %d blocks from cylinder %d, sector %d", nblocks, cyl, sec);
+    return 0;
+}
+
+int cmd_rm(int cyl, int sec, int nblocks, char *buf)
+{
+    if (cyl >= _ncyl || sec >= _nsec || cyl < 0 || sec < 0)
+    {
+        Log("Invalid cylinder or sector");
+        return 1;
+    }
+    if (buf == NULL)
+    {
+        Log("Buffer is NULL");
+        return 1;
+    }
+    long first = (long)cyl * _nsec + sec;
+    if (nblocks <= 0 || first + nblocks > (long)_ncyl * _nsec)
+    {
+        Log("Invalid block count %d", nblocks);
+        return 1;
+    }
+    // same seek model as cmd_wm
+    int last_cyl = (first + nblocks - 1) / _nsec;
+    int delay = abs(cyl - cur_cyl) * _ttd + (last_cyl - cyl) * _ttd;
+    usleep(delay * 1000);
+
+    memcpy(buf, diskfile + first * BLOCKSIZE, (long)nblocks * BLOCKSIZE);
+    cur_cyl = last_cyl;
+    Log("Read %d blocks from cylinder %d, sector %d", nblocks, cyl, sec);
+    return 0;
+}
+
 void close_disk()
 {
     // unmap
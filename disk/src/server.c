@@ -81,6 +81,69 @@ int handle_w(tcp_buffer *wb, char *args, int len)
     return 0;
 }
 
+int handle_wm(tcp_buffer *wb, char *args, int len)
+{
+    int cyl;
+    int sec;
+    int nblocks;
+
+    if (sscanf(args, "%d %d %d", &cyl, &sec, &nblocks) != 3)
+    {
+        reply_with_no(wb, NULL, 0);
+        return 0;
+    }
+    char *ptr = args;
+    int space_count = 0;
+    while (*ptr && space_count < 3)
+    {
+        if (*ptr == ' ')
+            space_count++;
+        ptr++;
+    }
+
+    if (space_count < 3 || len - (ptr - args) < (long)nblocks * 512)
+    {
+        reply_with_no(wb, NULL, 0);
+        return 0;
+    }
+
+    if (cmd_wm(cyl, sec, nblocks, ptr) == 0)
+    {
+        reply_with_yes(wb, NULL, 0);
+    }
+    else
+    {
+        reply_with_no(wb, NULL, 0);
+    }
+    return 0;
+}
+
+// at most this many blocks fit in one reply (TCP_BUF_SIZE)
+#define MAX_RM_BLOCKS 7
+
+int handle_rm(tcp_buffer *wb, char *args, int len)
+{
+    int cyl;
+    int sec;
+    int nblocks;
+    char buf[512 * MAX_RM_BLOCKS];
+
+    if (sscanf(args, "%d %d %d", &cyl, &sec, &nblocks) != 3 || nblocks <= 0 || nblocks > MAX_RM_BLOCKS)
+    {
+        reply_with_no(wb, NULL, 0);
+        return 0;
+    }
+    if (cmd_rm(cyl, sec, nblocks, buf) == 0)
+    {
+        reply_with_yes(wb, buf, nblocks * 512);
+    }
+    else
+    {
+        reply_with_no(wb, NULL, 0);
+    }
+    return 0;
+}
+
 int handle_e(tcp_buffer *wb, char *args, int len)
 {
     const char *msg = "Bye!";
@@ -96,6 +159,8 @@ static struct
     {"I", handle_i},
     {"R", handle_r},
     {"W", handle_w},
+    {"WM", handle_wm},
+    {"RM", handle_rm},
     {"E", handle_e},
 };
 
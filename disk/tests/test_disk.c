@@ -131,6 +131,59 @@ mt_test(test_out_of_bounds)
     return 0;
 }
 
+mt_test(test_wm)
+{
+    setup_disk();
+    char write_buf[512 * 4];
+    char read_buf[512];
+
+    for (int i = 0; i < sizeof(write_buf); i++)
+    {
+        write_buf[i] = 'a' + (i / 512);
+    }
+
+    // cross the boundary between cylinder 4 and 5
+    int write_result = cmd_wm(4, 8, 4, write_buf);
+    mt_assert(write_result == 0);
+
+    for (int i = 0; i < 4; i++)
+    {
+        int read_result = cmd_r(4 + (8 + i) / 10, (8 + i) % 10, read_buf);
+        mt_assert(read_result == 0);
+        mt_assert(memcmp(write_buf + i * 512, read_buf, 512) == 0);
+    }
+
+    // past the end of the disk
+    write_result = cmd_wm(9, 8, 4, write_buf);
+    mt_assert(write_result != 0);
+    close_disk();
+    return 0;
+}
+
+mt_test(test_rm)
+{
+    setup_disk();
+    char write_buf[512 * 3];
+    char read_buf[512 * 3];
+
+    for (int i = 0; i < sizeof(write_buf); i++)
+    {
+        write_buf[i] = 'a' + (i / 512);
+    }
+    int write_result = cmd_wm(2, 9, 3, write_buf);
+    mt_assert(write_result == 0);
+
+    int read_result = cmd_rm(2, 9, 3, read_buf);
+    mt_assert(read_result == 0);
+    mt_assert(memcmp(write_buf, read_buf, sizeof(write_buf)) == 0);
+
+    // past the end of the disk
+    read_result = cmd_rm(9, 9, 2, read_buf);
+    mt_assert(read_result != 0);
+    close_disk();
+    return 0;
+}
+
 void disk_tests()
 {
     mt_run_test(test_cmd_i);
@@ -139,4 +192,6 @@ void disk_tests()
     mt_run_test(test_w_partial);
     mt_run_test(test_non_ascii);
     mt_run_test(test_out_of_bounds);
+    mt_run_test(test_wm);
+    mt_run_test(test_rm);
 }
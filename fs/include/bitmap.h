@@ -14,6 +14,13 @@ typedef enum
 int bitmap_is_used(bitmap_type_t type, uint item_num);
 int bitmap_set(bitmap_type_t type, uint item_num, int used);
 int bitmap_find_free(bitmap_type_t type);
+int bitmap_alloc(bitmap_type_t type);
+int bitmap_set_range(bitmap_type_t type, uint start, uint n, int used);
+int bitmap_next_free_run(bitmap_type_t type, uint from, uint *start);
+int bitmap_free_count(bitmap_type_t type);
+int bitmap_find_free_from(bitmap_type_t type, uint from);
+int bitmap_region_free(bitmap_type_t type, uint r);
+int bitmap_sync(void);
 
 
 // 便捷的包装函数
@@ -51,6 +58,10 @@ static inline int block_bitmap_find_free(void)
 {
     return bitmap_find_free(BITMAP_BLOCK);
 }
+static inline int block_bitmap_alloc(void)
+{
+    return bitmap_alloc(BITMAP_BLOCK);
+}
 
 // 批量操作函数
 int bitmap_clear_all(bitmap_type_t type);
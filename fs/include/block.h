@@ -3,6 +3,8 @@
 
 #include "common.h"
 
+#define NORPHAN 16 // Orphan table entries in the superblock
+
 typedef struct
 {
     uint magic;     // Magic number, used to identify the file system (0xf0f03410)
@@ -22,7 +24,37 @@ typedef struct
 
     uint datastart;  // Block number of first data block
     uint ndatablocks; // Total number of data blocks
-} superblock; // 48 bytes
+
+    uint features;   // Feature flags chosen at format time (FEAT_*)
+
+    // Cylinder groups (FEAT_CGROUPS); zero on file systems formatted without them
+    uint ncg;        // Number of cylinder groups
+    uint cgblocks;   // Blocks per group (one block bitmap block covers a group)
+    uint ipg;        // Inodes per group
+    uint cgiblocks;  // Inode table blocks per group
+
+    // Orphan table: unlinked inodes whose blocks are still being freed, resumed at mount
+    uint norphan;             // Entries in use
+    uint orphans[NORPHAN];    // Inode numbers
+} superblock; // 136 bytes
+
+// superblock features
+#define FEAT_EXTENTS 0x1 // New inodes map their blocks with extents
+#define FEAT_INLINE_DATA 0x2 // Small files keep their data inside the dinode
+#define FEAT_CGROUPS 0x4 // Disk is split into cylinder groups, each with its own bitmaps and inode table
+#define FS_DEFAULT_FEATURES (FEAT_EXTENTS | FEAT_INLINE_DATA | FEAT_CGROUPS) // Features used by a plain format
+
+// 柱面组布局: 组 g 从块 g * cgblocks 开始, 依次是块位图、inode 位图、inode 表, 然后是数据块;
+// 组 0 在最前面多一个超级块, 在 inode 表之后放日志区
+#define CG_MIN_BLOCKS 64 // 末尾不足一组的块至少要有这么多数据块才单独成组, 否则不使用
+uint cg_count(void);
+uint cg_of_block(uint bno);
+uint cg_start(uint g);
+uint cg_bmap_block(uint g);
+uint cg_ibmap_block(uint g);
+uint cg_inode_start(uint g);
+uint cg_data_start(uint g);
+uint cg_end(uint g);
 
 // sb is defined in block.c
 extern superblock sb;
@@ -30,15 +62,80 @@ extern superblock sb;
 // RAMDISK
 extern uchar ramdisk[MAXBLOCK];
 
+// 空闲区间长度直方图的档数 (第 k 档为长度 [2^k, 2^(k+1)), 最后一档包含更长的区间)
+#define ALLOC_ORDERS 12
+
+// 分配器统计
+typedef struct
+{
+    uint free_blocks;        // 空闲块数
+    int free_extents;        // 空闲区间数
+    uint largest;            // 最长的空闲区间
+    int hist[ALLOC_ORDERS];  // 空闲区间按长度分档的个数
+    long allocs;             // 分配请求数
+    long blocks;             // 分配出的块数
+    long near_hits;          // 正好从目标块开始分配的请求数
+    long short_allocs;       // 没有足够长的区间, 只分配到一部分的请求数
+    long frees;              // 释放的块数
+    long total_ns;           // 分配耗时总和 (纳秒)
+    long max_ns;             // 单次分配的最长耗时 (纳秒)
+    uint reserved;           // 当前预留给写入流、尚未使用的块数
+    long windows;            // 预留窗口数
+    long resv_blocks;        // 从预留窗口中分配的块数
+    long resv_released;      // 没有用完而归还的预留块数
+} alloc_stats_t;
+
 void zero_block(uint bno); 
+void zero_blocks(uint start, uint n);
 uint allocate_block(); 
+uint allocate_block_uninit(); 
+uint allocate_block_near(uint goal); 
+uint allocate_blocks(uint goal, uint want, uint *start); 
+uint reserve_blocks(uint goal, uint want, uint *start, uint *gen);
+int claim_reserved(uint start, uint n, uint gen);
+void release_reserved(uint start, uint n, uint gen);
 void free_block(uint bno); 
+void alloc_get_stats(alloc_stats_t *st);
+int alloc_format_stats(char *out, int size);
+int block_uninit(uint bno);
+long block_zero_writes_saved(void);
+
+// 释放块时是否清零 (0: 只标记空闲并丢弃缓存中的副本, 1: 写入全零后再释放)
+#define BLOCK_ZERO_ON_FREE 0
+
+// 块类别, 缓存据此区分元数据和文件数据
+enum
+{
+    BC_SUPER = 0, // 超级块
+    BC_BITMAP,    // 数据块位图和 inode 位图
+    BC_INODE,     // inode 表
+    BC_LOG,       // 日志区
+    BC_DIR,       // 目录数据块
+    BC_INDIRECT,  // 间接索引块
+    BC_DATA,      // 文件数据块
+    BC_NCLASS,
+};
+#define BC_IS_META(cls) ((cls) != BC_DATA)
+
+// 单次多块磁盘请求的最大块数 (受 TCP_BUF_SIZE 限制)
+#define MAX_IO_BLOCKS 7
 
 void get_disk_info(int *ncyl, int *nsec);
 void raw_read_block(int blockno, uchar *buf);
 void raw_write_block(int blockno, uchar *buf);
+void raw_write_blocks(int blockno, int nblocks, uchar *buf);
+int raw_read_blocks(int blockno, int nblocks, uchar *buf);
+int disk_head_cyl(void);
 void read_block(int blockno, uchar *buf);
+void read_block_stream(int blockno, uchar *buf);
 void write_block(int blockno, uchar *buf);
+void read_block_as(int blockno, uchar *buf, int cls);
+void write_block_as(int blockno, uchar *buf, int cls);
+void write_blocks_as(int blockno, int nblocks, uchar *buf, int cls);
+int block_class(int blockno, int hint);
+void prefetch_blocks(const uint *blocks, int n, int cls);
+int block_cached(int blockno);
+const char *block_class_name(int cls);
 
 void init_block_bitmap();
 int init_disk_connection(const char *host, int port);
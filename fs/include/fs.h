@@ -15,13 +15,23 @@ typedef struct
     char name[MAXNAME];
 } entry; // 32 bytes, 16 entries per block
 
+#define READ_CHUNK 1024 // 流式读取时每次 readi 的字节数, 内存占用与文件大小无关
+
+// 流式读取的回调: 依次收到每一段数据, 返回负数时停止读取 (cmd_read 返回 E_ERROR)
+typedef int (*read_emit_fn)(void *arg, const uchar *data, uint n);
+
 // 公共函数声明（给 server.c 等外部模块使用）
 void sbinit(int ncyl_, int nsec_);
 char *get_current_path(void);
 void update_current_path(const char *path);
+void fs_set_sync(int sync); // 设置当前请求是否同步写回
+int fs_sync(void);          // 立即把脏块写回磁盘
+void fs_lock(void);         // 命令执行期间持有, 与后台线程互斥
+void fs_unlock(void);
 
 // 主要命令接口
 int cmd_f(int ncyl, int nsec);
+int cmd_format(int ncyl, int nsec, uint features);
 int cmd_mk(char *name, short mode);
 int cmd_mkdir(char *name, short mode);
 int cmd_rm(char *name);
@@ -29,10 +39,17 @@ int cmd_rmdir(char *name);
 int cmd_cd(char *path);
 int cmd_ls(entry **entries, int *n);
 int cmd_cat(char *name, uchar **buf, uint *len);
+int cmd_read(char *name, uint off, uint len, read_emit_fn emit, void *arg);
 int cmd_w(char *name, uint len, const char *data);
 int cmd_i(char *name, uint pos, uint len, const char *data);
 int cmd_d(char *name, uint pos, uint len);
+int cmd_pwrite(char *name, uint off, uint len, const char *data);
+int cmd_append(char *name, uint len, const char *data);
+int cmd_fallocate(char *name, uint len);
+int cmd_pieces(char *name, int on);
 int cmd_login(int auid);
 int cmd_adduser(int uid);
+int cmd_cachestat(char *out, int size);
+int cmd_allocstat(char *out, int size);
 
 #endif
\ No newline at end of file
@@ -9,7 +9,8 @@ extern uint current_uid;
 
 // 内部函数声明
 // fs_format.c
-void init_sb(int size);
+void init_sb(int size, uint features);
+void write_sb(void);
 void init_root_directory();
 int init_directory_entries(uint dir_inum, uint parent_inum, uint data_block, short mode);
 
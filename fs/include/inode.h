@@ -1,6 +1,7 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+
 #include "common.h"
 
 enum
@@ -19,13 +20,86 @@ typedef struct
     ushort nlink;            // Number of links
     ushort uid;              // User ID
     uint size;               // Size in bytes
-    ushort dirty;              // Dirty flag, 1 if inode is modified
+    ushort flags;            // Inode flags (IF_*)
     ushort blocks;          // Number of blocks allocated (for file size)
     uint addrs[NDIRECT + 2]; // Data block addresses, the last two are indirect blocks
 } dinode; // 64 bytes, 8 dinodes for each blocks
 
-// inode in memory
-// more useful fields can be added, e.g. reference count
+// inode flags
+#define IF_EXTENTS 0x1 // addrs holds extents instead of direct/indirect addresses
+#define IF_INLINE 0x2  // addrs holds the file data itself (size <= INLINE_MAX)
+#define IF_ORPHAN 0x4  // Unlinked, listed in the superblock orphan table until its blocks are freed
+#define IF_PIECES 0x8  // Data is a piece table over an append-only log kept in the extent blocks
+
+#define INLINE_MAX (sizeof(uint) * (NDIRECT + 2)) // Largest file stored inline, 48 bytes
+
+// A run of physically contiguous blocks
+typedef struct
+{
+    uint lblk; // First logical block
+    uint pblk; // First physical block
+    uint len;  // Number of blocks
+} extent;
+
+// Extent inodes reuse addrs: addrs[0..8] hold NINLINE_EXT extents,
+// addrs[EXT_COUNT] the number in use and addrs[EXT_OVERFLOW] the first overflow block
+#define NINLINE_EXT 3
+#define EXT_COUNT (NINLINE_EXT * 3)
+#define EXT_OVERFLOW (NDIRECT + 1)
+
+// Overflow extent block, chained through next
+#define EXTENTS_PER_BLOCK ((BSIZE - 2 * sizeof(uint)) / sizeof(extent))
+typedef struct
+{
+    uint count; // Extents in use
+    uint next;  // Next overflow block, 0 if none
+    extent e[EXTENTS_PER_BLOCK];
+} extent_block;
+
+// Piece-table files (IF_PIECES, extent inodes only): the extent blocks hold an append-only log
+// of the original data and every inserted byte, and the file is the concatenation of the pieces.
+// addrs[PT_HEAD], unused by extents, points to a chain of piece blocks
+#define PT_HEAD NDIRECT
+typedef struct
+{
+    uint off; // Start of the piece in the log
+    uint len; // Bytes
+} piece;
+
+#define PIECES_PER_BLOCK ((BSIZE - 4 * sizeof(uint)) / sizeof(piece))
+typedef struct
+{
+    uint count;    // Pieces in this block
+    uint next;     // Next piece block, 0 if none
+    uint log_size; // Bytes used in the log (head block)
+    uint total;    // Pieces in the whole table (head block)
+    piece p[PIECES_PER_BLOCK];
+} piece_block;
+
+#define PT_MAX_BLOCKS 4                              // Longest piece table chain
+#define PIECE_MAX (PT_MAX_BLOCKS * PIECES_PER_BLOCK) // Tables this full are compacted before the next edit
+#define PIECE_COMPACT 64                             // Files with more pieces are compacted when the command ends
+
+// Decoded copy of an indirect (or overflow extent) block, cached per inode
+#define IMAP_SLOTS 3 // Enough for the double-indirect root plus one level-1 block and the single indirect block
+typedef struct
+{
+    uint blockno;        // Cached block, 0 if empty
+    unsigned long used;  // Last use, the least recently used slot is replaced
+    uint addrs[APB];
+} imap_entry;
+
+// Sequential read detection and read-ahead state of a cached inode
+typedef struct
+{
+    uint next_block; // Logical block the next sequential read would access
+    uint run;        // Blocks read sequentially so far
+    uint ra_window;  // Read-ahead window (blocks)
+    uint ra_mark;    // Reading this logical block starts the next read-ahead
+    uint ra_end;     // Read ahead up to this logical block (exclusive)
+} seq_state;
+
+// inode in memory, kept in the inode cache
 typedef struct
 {
     uint inum;    // Inode number
@@ -36,34 +110,94 @@ typedef struct
     uint size;    // Size in bytes
     ushort dirty;   // Dirty flag, 1 if inode is modified
     ushort blocks; // Number of blocks allocated (for file size)
+    ushort flags;  // Inode flags (IF_*)
     uint addrs[NDIRECT + 2];
+
+    int ref;              // References handed out by iget/ialloc
+    int valid;            // Cache slot holds inode inum
+    unsigned long lru;    // Time stamp of the last iput, the oldest unreferenced slot is reused first
+
+    imap_entry imap[IMAP_SLOTS]; // Recently used mapping blocks, dropped on truncate
+    unsigned long imap_tick;
+    seq_state seq; // Sequential read state, reset with the mapping cache
+
+    uint pa_start; // Next block of the preallocation window
+    uint pa_len;   // Reserved blocks left in the window, 0 if none
+    uint pa_gen;   // Allocator generation the window was reserved in
+    long pa_used;  // Last use of the window (ms), idle windows are released
+
+    int da_head;   // First delayed block in the delalloc pool (valid if da_count > 0)
+    uint da_count; // Written blocks still waiting for a physical block
+    long da_since; // When the oldest delayed block was written (ms)
 } inode;
 
-// Get an inode by number (returns allocated inode or NULL)
-// Don't forget to use iput()
+#define ICACHE_SIZE 64 // Number of in-memory inodes
+
+// Appending writers take blocks from a per-inode window of reserved contiguous blocks,
+// so that files written at the same time do not interleave on disk
+#define PREALLOC_MIN 8        // Smallest window in blocks
+#define PREALLOC_MAX 128      // Windows grow with the file up to this many blocks
+#define PREALLOC_IDLE_MS 5000 // Windows of unreferenced inodes unused this long are released
+
+// Delayed allocation: data written into holes of a file is kept in memory by (inode, logical block)
+// and gets physical blocks only when flushed, once the file's final extent is known
+#define DELALLOC_MAX_BLOCKS 256 // Delayed blocks held in memory at most
+#define DELALLOC_EXPIRE_MS 3000 // Delayed blocks older than this are flushed when a command ends or, between commands, by the writeback thread
+
+// Get an inode by number (returns a cached inode or NULL)
+// Repeated calls return the same object; don't forget to use iput()
 inode *iget(uint inum);
 
 void free_inode_blocks(inode *ip);
 void free_inode_in_bitmap(uint inum);
 void clear_disk_inode(uint inum);
-// Free an inode (or decrement reference count)
+// Decrement the reference count, freeing the inode on the last reference if it has no links
 void iput(inode *ip);
 
+void icache_invalidate(void);              // Drop all cached inodes (after format)
+void prealloc_release_idle(void);          // Return idle preallocation windows to the allocator
+void delalloc_set(int on);                 // Turn delayed allocation on or off (off flushes first)
+void delalloc_flush(int all);              // Flush expired delayed blocks, or all of them
+int icache_format_stats(char *out, int size); // Append hit/miss counters to out
+
 void init_inode(inode *ip, uint inum, short type);
 int mark_inode_used(uint inum);
 // Allocate a new inode of specified type (returns allocated inode or NULL)
 // Don't forget to use iput()
 inode *ialloc(short type);
+inode *ialloc_in(short type, uint parent);
 
 // Update disk inode with memory inode contents
 void iupdate(inode *ip);
 
 uint bmap(inode *ip, uint bn); // Get the block number for a given block index
+uint bmap_lookup(inode *ip, uint bn); // Same as bmap but never allocates, returns 0 for holes
+uint inode_mapped_end(inode *ip);     // One past the last mapped logical block, 0 if none
+uint itrunc(inode *ip, uint keep);    // Free every block from logical block keep on, returns blocks freed
+int inode_extent_count(inode *ip);   // Number of extents of an extent inode, -1 otherwise
 // Read from an inode (returns bytes read or -1 on error)
 int readi(inode *ip, uchar *dst, uint off, uint n);
 
 // Write to an inode (returns bytes written or -1 on error)
 int writei(inode *ip, uchar *src, uint off, uint n);
 
+// Allocate blocks for [0, len) without changing the size (returns blocks allocated or -1 on error)
+int ifallocate(inode *ip, uint len);
+
+// Insert n bytes at pos or delete n bytes at pos, shifting the rest of the file
+// Piece-table files only edit the table; other files shift their tail with ishift
+int iinsert(inode *ip, uint pos, uchar *src, uint n);
+int idelete(inode *ip, uint pos, uint n);
+
+// Switch a file to (on) or from piece-table mode, returns 0 or -1
+int ipieces(inode *ip, int on);
+int piece_count(inode *ip);      // Pieces in the table, -1 if the file is not in piece-table mode
+int icompact(inode *ip);         // Rewrite a piece-table file as a single piece over a flat log
+void piece_compact_pending(void); // Compact cached files with more than PIECE_COMPACT pieces
+
+// Move [off, size) by delta bytes through a one-block buffer, shrinking or growing the file (returns 0 or -1)
+// Growing leaves [off, off + delta) for the caller to fill; shrinking frees the blocks past the new end
+int ishift(inode *ip, uint off, int delta);
+
 void init_inode_system(); // Initialize the inode system
 #endif
@@ -0,0 +1,21 @@
+#ifndef ORPHAN_H
+#define ORPHAN_H
+
+#include "common.h"
+
+// 后台回收配置
+#define RECLAIM_BATCH 64 // 回收线程每批释放的逻辑块数, 批与批之间让出文件系统锁
+
+// 孤儿表: 删除的文件先记入超级块中的孤儿表, 数据块由后台回收线程分批释放
+int orphan_full(void);
+int orphan_add(uint inum);
+int orphan_pending(void);
+
+// 后台回收线程
+int reclaim_start(void);
+void reclaim_stop(void);
+int reclaim_active(void);
+void reclaim_drain(void); // 直接回收孤儿表中剩下的 inode, 调用者持有文件系统锁
+int reclaim_format_stats(char *out, int size);
+
+#endif
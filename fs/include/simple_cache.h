@@ -5,8 +5,20 @@
 #include "block.h"
 
 // 块缓存配置
-#define BLOCK_CACHE_SIZE 500 
+#define BLOCK_CACHE_SIZE 500 // 默认槽位数, 可用 cache_init_size 修改
 #define CACHE_DISABLED 0    // 是否禁用缓存
+#define CACHE_DATA_RESERVE_PCT 10 // 为文件数据保留的槽位比例(%), 其余元数据可用
+
+// 后台写回配置
+#define CACHE_DIRTY_RATIO 20            // 脏块占比(%)超过该值时唤醒写回线程
+#define CACHE_DIRTY_EXPIRE_MS 3000      // 脏块最长驻留时间(毫秒), 类似内核 dirty_expire
+#define CACHE_WRITEBACK_INTERVAL_MS 500 // 写回线程的唤醒周期(毫秒)
+#define CACHE_WRITEBACK_BATCH 64        // 每批写回的最大块数 (批内按柱面排序、合并)
+
+// 热块清单 (重启后预热缓存)
+#define CACHE_MANIFEST_FILE "cache.manifest" // 清单文件, 位于服务器工作目录
+#define CACHE_MANIFEST_INTERVAL_MS 30000      // 写回线程保存清单的周期(毫秒)
+#define CACHE_MANIFEST_MAGIC 0x4d434653
 
 // 缓存项
 typedef struct block_cache_entry
@@ -15,12 +27,67 @@ typedef struct block_cache_entry
     uchar data[BSIZE]; // 块数据
     int valid;         // 是否有效 (0: 无效, 1: 有效)
     int dirty;         // 是否脏数据 (0: 干净, 1: 脏)
+    int writeback;     // 是否正在被写回线程写回 (写回期间不可被替换)
+    int loading;       // 是否正在从磁盘读入 (读入期间不可被替换, 其他读者等待)
+    long dirty_since;  // 变脏的时间 (毫秒, 单调时钟)
+    int dirty_prev;    // 脏链表前驱槽位 (-1 表示无)
+    int dirty_next;    // 脏链表后继槽位 (-1 表示无)
+    int hash_next;     // 哈希链后继槽位 (-1 表示无)
+    int cls;           // 块类别 (BC_*)
+    int lru_prev;      // LRU 链表前驱 (更热的一侧)
+    int lru_next;      // LRU 链表后继 (更冷的一侧)
 } block_cache_entry_t;
 
+// 命中统计
+typedef struct
+{
+    long hits;         // 命中次数
+    long misses;       // 未命中次数
+    long stream_reads; // 顺序扫描读取的块数 (包含在上面两项中)
+    long bypass;       // 没有可替换的数据槽位而绕过缓存的次数
+    long coalesced;    // 等待其他线程读盘而未重复读盘的次数
+    long prefetched;   // 预取读入的块数
+    long discarded;    // 块被释放而丢弃的缓存副本数
+    long discarded_dirty; // 其中未写回的脏块数 (省下的写盘次数)
+    long class_hits[BC_NCLASS];   // 按块类别统计的命中次数
+    long class_misses[BC_NCLASS]; // 按块类别统计的未命中次数
+} cache_stats_t;
+
+// 写回统计
+typedef struct
+{
+    long flushes;       // 写回批次数
+    long blocks;        // 写回的块数
+    long requests;      // 合并后发出的磁盘请求数
+    long seek_distance; // 按柱面排序后的模拟寻道距离 (柱面数)
+    long seek_unsorted; // 同一批块按槽位顺序写回时的模拟寻道距离
+} cache_writeback_stats_t;
+
 // 函数声明
 void cache_init(void);
-void cached_read_block(int blockno, uchar *buf);
-void cached_write_block(int blockno, uchar *buf);
+int cache_init_size(int nslots);
+void cached_read_block(int blockno, uchar *buf, int cls);
+void cached_read_block_stream(int blockno, uchar *buf);
+void cached_write_block(int blockno, uchar *buf, int cls);
+void cached_write_blocks(int blockno, int nblocks, uchar *buf, int cls);
+void cache_prefetch(const uint *blocks, int n, int cls);
+int cache_contains(int blockno);
+void cache_discard(int blockno);
 void cache_flush(void);
 
-#endif
\ No newline at end of file
+// 后台写回
+int cache_start_writeback(void);
+void cache_stop_writeback(void);
+int cache_writeback_active(void);
+void cache_set_writeback_hook(void (*hook)(void)); // 写回线程每个周期开始时调用 (不持有缓存锁)
+int cache_dirty_count(void);
+void cache_get_stats(cache_stats_t *st);
+int cache_format_stats(char *out, int size);
+void cache_get_writeback_stats(cache_writeback_stats_t *st);
+
+// 热块清单
+void cache_set_manifest(const char *path);
+int cache_save_manifest(void);
+int cache_warm_start(void);
+
+#endif
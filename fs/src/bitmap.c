@@ -2,17 +2,51 @@
 #include "block.h"
 #include "inode.h"
 #include "log.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
-// 获取位图的起始块和块数
-static void get_bitmap_info(bitmap_type_t type, uint *start_block, uint *num_blocks, uint *max_items)
+#define WORD_BITS 64
+#define WORDS_PER_BLOCK (BPB / WORD_BITS) // 每个位图块 64 个字
+
+// 内存中的位图: 全部位以 64 位字保存, 修改只标记所在位图块为脏, 由 bitmap_sync 写回
+// 每个位图块在内存中占 BPB 位 (一个区域), 块内只有前 per_block 位有效;
+// 小端序下字的内存布局与磁盘上的字节布局相同, 位图块可以直接拷贝
+typedef struct
 {
+    uint64_t *words;   // 位图内容, 无效的填充位视为已用
+    uint *region_free; // 每个位图块 (区域) 中的空闲项数, 扫描时跳过已满的区域
+    uchar *dirty;      // 位图块是否需要写回
+    uint start_block;  // 第一个位图块
+    uint num_blocks;   // 位图块数
+    uint max_items;    // 项数
+    uint per_block;    // 每个位图块覆盖的项数 (柱面组的 inode 位图为每组 inode 数)
+    bitmap_type_t type;
+    uint nfree;        // 空闲项总数
+    uint hint;         // next-fit 起点: 上一次分配之后的项
+    int loaded;
+    pthread_mutex_t lock;
+} mem_bitmap;
+
+static mem_bitmap bitmaps[2] = {
+    [BITMAP_INODE] = {.type = BITMAP_INODE, .lock = PTHREAD_MUTEX_INITIALIZER},
+    [BITMAP_BLOCK] = {.type = BITMAP_BLOCK, .lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+// 获取位图的起始块、块数、项数和每块覆盖的项数
+static void get_bitmap_info(bitmap_type_t type, uint *start_block, uint *num_blocks, uint *max_items,
+                            uint *per_block)
+{
+    *per_block = BPB;
     switch (type)
     {
     case BITMAP_INODE:
         *start_block = sb.inodebmapstart;
         *num_blocks = sb.inodebmapblocks;
         *max_items = sb.ninodes;
+        if (cg_count() > 0)
+            *per_block = sb.ipg;
         break;
     case BITMAP_BLOCK:
         *start_block = sb.bmapstart;
@@ -22,132 +56,347 @@ static void get_bitmap_info(bitmap_type_t type, uint *start_block, uint *num_blo
     }
 }
 
-// 计算位图中的位置
-typedef struct
+// 第 i 个位图块的磁盘位置: 使用柱面组时位于各组开头, 否则连续存放
+static uint bitmap_block_addr(const mem_bitmap *bm, uint i)
+{
+    if (cg_count() > 0)
+        return bm->type == BITMAP_INODE ? cg_ibmap_block(i) : cg_bmap_block(i);
+    return bm->start_block + i;
+}
+
+// 项号与内存中位下标的换算 (每个位图块对应 BPB 位)
+static inline uint bit_of(const mem_bitmap *bm, uint item)
 {
-    uint block_index; // 位图块索引
-    uint byte_index;  // 字节索引
-    uint bit_index;   // 位索引
-} bitmap_pos_t;
+    return (item / bm->per_block) * BPB + item % bm->per_block;
+}
 
-static bitmap_pos_t get_bitmap_position(uint item_num)
+static inline uint item_of(const mem_bitmap *bm, uint bit)
 {
-    bitmap_pos_t pos;
-    pos.block_index = item_num / (BSIZE * 8);
-    pos.byte_index = (item_num % (BSIZE * 8)) / 8;
-    pos.bit_index = item_num % 8;
-    return pos;
+    return (bit / BPB) * bm->per_block + bit % BPB;
 }
 
-// 检查位图中某项是否被使用
-int bitmap_is_used(bitmap_type_t type, uint item_num)
+static inline int test_bit(const mem_bitmap *bm, uint item)
+{
+    uint b = bit_of(bm, item);
+    return (bm->words[b / WORD_BITS] >> (b % WORD_BITS)) & 1;
+}
+
+// 修改一位并维护空闲计数和脏标记 (调用者持有 bm->lock)
+static void set_bit(mem_bitmap *bm, uint item, int used)
 {
-    uint start_block, num_blocks, max_items;
-    get_bitmap_info(type, &start_block, &num_blocks, &max_items);
+    uint b = bit_of(bm, item);
+    uint64_t mask = 1ULL << (b % WORD_BITS);
+    uint64_t *w = &bm->words[b / WORD_BITS];
+    if (((*w & mask) != 0) == (used != 0))
+        return;
+    if (used)
+    {
+        *w |= mask;
+        bm->region_free[b / BPB]--;
+        bm->nfree--;
+    }
+    else
+    {
+        *w &= ~mask;
+        bm->region_free[b / BPB]++;
+        bm->nfree++;
+    }
+    bm->dirty[b / BPB] = 1;
+}
 
-    if (item_num >= max_items)
+// 按当前超级块布局建立内存位图, from_disk 为 0 时为全空 (调用者持有 bm->lock)
+static int bitmap_load(mem_bitmap *bm, uint start_block, uint num_blocks, uint max_items, uint per_block,
+                       int from_disk)
+{
+    free(bm->words);
+    free(bm->region_free);
+    free(bm->dirty);
+    bm->loaded = 0;
+    uint nwords = num_blocks * WORDS_PER_BLOCK;
+    bm->words = calloc(nwords, sizeof(uint64_t));
+    bm->region_free = calloc(num_blocks, sizeof(uint));
+    bm->dirty = calloc(num_blocks, 1);
+    if (!bm->words || !bm->region_free || !bm->dirty)
     {
-        Error("bitmap_is_used: item %d out of range (max %d)", item_num, max_items);
+        Error("bitmap_load: out of memory for %d bitmap blocks", num_blocks);
         return -1;
     }
+    bm->start_block = start_block;
+    bm->num_blocks = num_blocks;
+    bm->max_items = max_items;
+    bm->per_block = per_block;
+
+    if (from_disk)
+    {
+        for (uint i = 0; i < num_blocks; i++)
+            read_block(bitmap_block_addr(bm, i), (uchar *)(bm->words + i * WORDS_PER_BLOCK));
+    }
+    for (uint b = 0; b < nwords * WORD_BITS; b++)
+    {
+        if (b % BPB >= per_block || item_of(bm, b) >= max_items)
+            bm->words[b / WORD_BITS] |= 1ULL << (b % WORD_BITS);
+    }
 
-    bitmap_pos_t pos = get_bitmap_position(item_num);
+    bm->nfree = 0;
+    for (uint i = 0; i < num_blocks; i++)
+    {
+        uint used = 0;
+        for (uint w = 0; w < WORDS_PER_BLOCK; w++)
+            used += __builtin_popcountll(bm->words[i * WORDS_PER_BLOCK + w]);
+        bm->region_free[i] = BPB - used;
+        bm->nfree += BPB - used;
+    }
+    bm->hint = 0;
+    bm->loaded = 1;
+    return 0;
+}
 
-    if (pos.block_index >= num_blocks)
+// 取得加锁的内存位图, 第一次使用或超级块布局变化时从磁盘载入; 失败返回 NULL (不持有锁)
+static mem_bitmap *bitmap_get(bitmap_type_t type)
+{
+    uint start_block, num_blocks, max_items, per_block;
+    get_bitmap_info(type, &start_block, &num_blocks, &max_items, &per_block);
+    if (num_blocks == 0 || per_block == 0)
     {
-        Error("bitmap_is_used: block index %d out of range", pos.block_index);
-        return -1;
+        Error("bitmap_get: %s bitmap is not initialized", type == BITMAP_INODE ? "inode" : "block");
+        return NULL;
     }
+    mem_bitmap *bm = &bitmaps[type];
+    pthread_mutex_lock(&bm->lock);
+    if (!bm->loaded || bm->start_block != start_block || bm->num_blocks != num_blocks ||
+        bm->max_items != max_items || bm->per_block != per_block)
+    {
+        if (bitmap_load(bm, start_block, num_blocks, max_items, per_block, 1) < 0)
+        {
+            pthread_mutex_unlock(&bm->lock);
+            return NULL;
+        }
+        Log("bitmap_get: loaded %s bitmap, %d of %d free", type == BITMAP_INODE ? "inode" : "block", bm->nfree,
+            max_items);
+    }
+    return bm;
+}
 
-    uchar buf[BSIZE];
-    read_block(start_block + pos.block_index, buf);
+// 从 from 开始 (到末尾后回绕) 查找第一个空闲项: 逐字用 ctz 定位, 跳过没有空闲项的区域
+static int find_free_from(mem_bitmap *bm, uint from)
+{
+    if (bm->nfree == 0)
+        return -1;
+    uint nwords = bm->num_blocks * WORDS_PER_BLOCK;
+    if (from >= bm->max_items)
+        from = 0;
+    uint bit = bit_of(bm, from);
+    uint w = bit / WORD_BITS;
+    uint64_t avail = ~bm->words[w] & (~0ULL << (bit % WORD_BITS));
+    if (avail)
+        return item_of(bm, w * WORD_BITS + __builtin_ctzll(avail));
+    for (uint k = 1; k <= nwords; k++)
+    {
+        uint i = (w + k) % nwords;
+        if (i % WORDS_PER_BLOCK == 0 && bm->region_free[i / WORDS_PER_BLOCK] == 0 && k + WORDS_PER_BLOCK <= nwords)
+        {
+            k += WORDS_PER_BLOCK - 1; // 整个区域已满
+            continue;
+        }
+        if (~bm->words[i])
+            return item_of(bm, i * WORD_BITS + __builtin_ctzll(~bm->words[i]));
+    }
+    return -1;
+}
 
-    return (buf[pos.byte_index] & (1 << pos.bit_index)) ? 1 : 0;
+// 检查位图中某项是否被使用
+int bitmap_is_used(bitmap_type_t type, uint item_num)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    if (item_num >= bm->max_items)
+    {
+        Error("bitmap_is_used: item %d out of range (max %d)", item_num, bm->max_items);
+        pthread_mutex_unlock(&bm->lock);
+        return -1;
+    }
+    int used = test_bit(bm, item_num);
+    pthread_mutex_unlock(&bm->lock);
+    return used;
 }
 
 // 设置位图中某项的状态
 int bitmap_set(bitmap_type_t type, uint item_num, int used)
 {
-    uint start_block, num_blocks, max_items;
-    get_bitmap_info(type, &start_block, &num_blocks, &max_items);
-
-    if (item_num >= max_items)
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    if (item_num >= bm->max_items)
     {
-        Error("bitmap_set: item %d out of range (max %d)", item_num, max_items);
+        Error("bitmap_set: item %d out of range (max %d)", item_num, bm->max_items);
+        pthread_mutex_unlock(&bm->lock);
         return -1;
     }
+    set_bit(bm, item_num, used);
+    if (used)
+        bm->hint = item_num + 1;
+    pthread_mutex_unlock(&bm->lock);
+    return 0;
+}
+
+// 查找一个空闲项 (next-fit: 从上一次分配的位置之后开始)
+int bitmap_find_free(bitmap_type_t type)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    int item = find_free_from(bm, bm->hint);
+    pthread_mutex_unlock(&bm->lock);
+    return item;
+}
 
-    bitmap_pos_t pos = get_bitmap_position(item_num);
+// 从 from 开始 (到末尾后回绕) 查找一个空闲项, 用于按柱面组放置
+int bitmap_find_free_from(bitmap_type_t type, uint from)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    int item = find_free_from(bm, from);
+    pthread_mutex_unlock(&bm->lock);
+    return item;
+}
 
-    if (pos.block_index >= num_blocks)
-    {
-        Error("bitmap_set: block index %d out of range", pos.block_index);
+// 第 r 个位图块 (柱面组) 覆盖的空闲项数
+int bitmap_region_free(bitmap_type_t type, uint r)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
         return -1;
-    }
+    int n = r < bm->num_blocks ? (int)bm->region_free[r] : -1;
+    pthread_mutex_unlock(&bm->lock);
+    return n;
+}
 
-    uchar buf[BSIZE];
-    read_block(start_block + pos.block_index, buf);
+// 查找并标记一个空闲项, 查找和标记在同一次加锁内完成; 没有空闲项返回 -1
+int bitmap_alloc(bitmap_type_t type)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    int item = find_free_from(bm, bm->hint);
+    if (item >= 0)
+    {
+        set_bit(bm, item, 1);
+        bm->hint = item + 1;
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return item;
+}
 
+// 把 [start, start+n) 标记为 used, 超出范围的部分忽略
+int bitmap_set_range(bitmap_type_t type, uint start, uint n, int used)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    for (uint i = start; i < start + n && i < bm->max_items; i++)
+        set_bit(bm, i, used);
     if (used)
+        bm->hint = start + n;
+    pthread_mutex_unlock(&bm->lock);
+    return 0;
+}
+
+// 从 from 开始 (不回绕) 找到下一段连续的空闲项, 返回其长度 (0 表示没有), *start 为第一项
+// 项号与位下标一致时 (块位图) 才有意义
+int bitmap_next_free_run(bitmap_type_t type, uint from, uint *start)
+{
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return 0;
+    uint item = from;
+    while (item < bm->max_items)
+    {
+        if (item % BPB == 0 && bm->region_free[item / BPB] == 0)
+        {
+            item += BPB; // 整个区域已满
+            continue;
+        }
+        uint w = item / WORD_BITS;
+        uint64_t avail = ~bm->words[w] & (~0ULL << (item % WORD_BITS));
+        if (avail)
+        {
+            item = w * WORD_BITS + __builtin_ctzll(avail);
+            break;
+        }
+        item = (w + 1) * WORD_BITS;
+    }
+    if (item >= bm->max_items)
     {
-        buf[pos.byte_index] |= (1 << pos.bit_index);
+        pthread_mutex_unlock(&bm->lock);
+        return 0;
     }
-    else
+    uint first = item;
+    while (item < bm->max_items)
     {
-        buf[pos.byte_index] &= ~(1 << pos.bit_index);
+        uint w = item / WORD_BITS;
+        uint64_t used = bm->words[w] & (~0ULL << (item % WORD_BITS));
+        if (used)
+        {
+            item = w * WORD_BITS + __builtin_ctzll(used);
+            break;
+        }
+        item = (w + 1) * WORD_BITS;
     }
-
-    write_block(start_block + pos.block_index, buf);
-    return 0;
+    uint len = min(item, bm->max_items) - first;
+    pthread_mutex_unlock(&bm->lock);
+    *start = first;
+    return len;
 }
 
-// 查找第一个空闲项
-int bitmap_find_free(bitmap_type_t type)
+// 空闲项数
+int bitmap_free_count(bitmap_type_t type)
 {
-    uint start_block, num_blocks, max_items;
-    get_bitmap_info(type, &start_block, &num_blocks, &max_items);
+    mem_bitmap *bm = bitmap_get(type);
+    if (bm == NULL)
+        return -1;
+    int n = bm->nfree;
+    pthread_mutex_unlock(&bm->lock);
+    return n;
+}
 
-    for (uint i = 0; i < num_blocks; i++)
+// 把脏位图块写入块缓存, 返回写出的块数
+int bitmap_sync(void)
+{
+    int written = 0;
+    for (int t = 0; t < 2; t++)
     {
-        uchar buf[BSIZE];
-        read_block(start_block + i, buf);
-
-        for (int j = 0; j < BSIZE; j++)
+        mem_bitmap *bm = &bitmaps[t];
+        pthread_mutex_lock(&bm->lock);
+        for (uint i = 0; bm->loaded && i < bm->num_blocks; i++)
         {
-            if (buf[j] != 0xFF)
-            { // 这个字节中有空闲位
-                for (int k = 0; k < 8; k++)
-                {
-                    if ((buf[j] & (1 << k)) == 0)
-                    { // 找到空闲位
-                        uint item_num = i * BSIZE * 8 + j * 8 + k;
-
-                        if (item_num >= max_items)
-                        {
-                            return -1; // 超出范围，返回0表示未找到
-                        }
-                        return item_num;
-                    }
-                }
+            if (bm->dirty[i])
+            {
+                write_block(bitmap_block_addr(bm, i), (uchar *)(bm->words + i * WORDS_PER_BLOCK));
+                bm->dirty[i] = 0;
+                written++;
             }
         }
+        pthread_mutex_unlock(&bm->lock);
     }
-    return -1; // 未找到空闲项
+    return written;
 }
 
-// 清空整个位图（设置为全0）
+// 清空整个位图（设置为全0）, 所有位图块在下一次 bitmap_sync 时写回
 int bitmap_clear_all(bitmap_type_t type)
 {
-    uint start_block, num_blocks, max_items;
-    get_bitmap_info(type, &start_block, &num_blocks, &max_items);
-
-    uchar buf[BSIZE];
-    memset(buf, 0, BSIZE);
+    uint start_block, num_blocks, max_items, per_block;
+    get_bitmap_info(type, &start_block, &num_blocks, &max_items, &per_block);
 
-    for (uint i = 0; i < num_blocks; i++)
-    {
-        write_block(start_block + i, buf);
-    }
+    mem_bitmap *bm = &bitmaps[type];
+    pthread_mutex_lock(&bm->lock);
+    int ret = bitmap_load(bm, start_block, num_blocks, max_items, per_block, 0);
+    if (ret == 0)
+        memset(bm->dirty, 1, num_blocks);
+    pthread_mutex_unlock(&bm->lock);
+    if (ret < 0)
+        return -1;
 
     Log("bitmap_clear_all: cleared %s bitmap",
         type == BITMAP_INODE ? "inode" : "block");
@@ -157,20 +406,25 @@ int bitmap_clear_all(bitmap_type_t type)
 // 标记系统使用的块为已分配
 int bitmap_set_system_blocks_used(void)
 {
-    // 标记从块0到数据区开始之前的所有块为已使用
-    for (uint i = 0; i < sb.datastart; i++)
+    mem_bitmap *bm = bitmap_get(BITMAP_BLOCK);
+    if (bm == NULL)
     {
-        if (bitmap_set(BITMAP_BLOCK, i, 1) < 0)
-        {
-            Error("bitmap_set_system_blocks_used: failed to mark block %d", i);
-            return -1;
-        }
-        // else
-        // {
-        //     Log("bitmap_set_system_blocks_used: marked block %d as used", i);
-        // }
+        Error("bitmap_set_system_blocks_used: failed to load block bitmap");
+        return -1;
+    }
+    // 标记从块0到数据区开始之前的所有块为已使用, 使用柱面组时还有每组开头的位图和 inode 表
+    for (uint i = 0; i < sb.datastart && i < bm->max_items; i++)
+    {
+        set_bit(bm, i, 1);
     }
+    for (uint g = 1; g < cg_count(); g++)
+    {
+        for (uint i = cg_start(g); i < cg_data_start(g) && i < bm->max_items; i++)
+            set_bit(bm, i, 1);
+    }
+    bm->hint = sb.datastart;
+    pthread_mutex_unlock(&bm->lock);
 
     Log("bitmap_set_system_blocks_used: marked %d system blocks as used", sb.datastart);
     return 0;
-}
\ No newline at end of file
+}
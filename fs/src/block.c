@@ -1,7 +1,11 @@
 #include "block.h"
 #include "simple_cache.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "common.h"
 #include "log.h"
@@ -11,6 +15,17 @@
 superblock sb;
 // uchar ramdisk[MAXBLOCK];
 static tcp_client disk_client = NULL;
+// 磁盘连接锁: 一次请求-响应必须完整, 后台写回线程与请求线程共用同一连接
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static int head_cyl = 0; // 模拟的磁头位置 (最近一次访问的柱面)
+
+// 已分配但还没写过的块 (内容是旧数据), 读到时按全零处理; 第一次写入时清除
+// 标记只在内存中, 重启后丢失: 块映射写盘前块内容必须已经写过, 不会立即写入的块要用 zero_blocks 清零
+#define UNINIT_MAX (NCYL * NSEC)
+static uchar uninit_map[UNINIT_MAX / 8 + 1];
+static long zero_writes_saved = 0; // 省下的清零写次数
+
+static int cg_meta_block(uint b);
 
 // 磁盘信息
 extern int ncyl, nsec;
@@ -37,6 +52,29 @@ void cleanup_disk_connection()
     }
 }
 
+static void set_uninit(uint bno)
+{
+    if (bno < UNINIT_MAX)
+        __sync_fetch_and_or(&uninit_map[bno / 8], (uchar)(1 << (bno % 8)));
+}
+
+static void clear_uninit(uint bno)
+{
+    if (bno < UNINIT_MAX && (uninit_map[bno / 8] & (1 << (bno % 8))))
+        __sync_fetch_and_and(&uninit_map[bno / 8], (uchar)~(1 << (bno % 8)));
+}
+
+// 块是否已分配但还未写入
+int block_uninit(uint bno)
+{
+    return bno < UNINIT_MAX && (uninit_map[bno / 8] & (1 << (bno % 8))) != 0;
+}
+
+long block_zero_writes_saved(void)
+{
+    return zero_writes_saved;
+}
+
 void zero_block(uint bno)
 {
     uchar buf[BSIZE];
@@ -44,18 +82,260 @@ void zero_block(uint bno)
     write_block(bno, buf);
 }
 
-uint allocate_block()
+// 把连续的 n 个块写成全零 (一次最多 ZERO_RUN 块的多块写), 之后这些块不再是未初始化块
+#define ZERO_RUN 16
+void zero_blocks(uint start, uint n)
+{
+    static const uchar zeros[ZERO_RUN * BSIZE];
+    for (uint i = 0; i < n; i += ZERO_RUN)
+        write_blocks_as(start + i, min(ZERO_RUN, n - i), (uchar *)zeros, BC_DATA);
+}
+
+// 空闲区间分配器: 数据区的空闲空间按物理位置排序保存为区间 (起点, 长度)
+// 挂载或格式化后第一次分配时由位图重建, 之后每次分配和释放与位图同步更新 (都持有 alloc_lock)
+typedef struct
+{
+    uint start;
+    uint len;
+} free_extent;
+
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static free_extent *fext = NULL;     // 按起点排序的空闲区间
+static int fext_n = 0, fext_cap = 0; // 区间数和数组容量
+static int fext_loaded = 0;
+static uint fext_size = 0, fext_datastart = 0; // 重建时的超级块布局
+static uint fext_free = 0;                     // 空闲块总数
+static int fext_hist[ALLOC_ORDERS];           // 区间数按长度 (2 的幂) 分档
+static uint alloc_hint = 0;                    // 单块分配的 next-fit 起点
+static uint resv_gen = 0;                      // 每次重建加一, 之前预留的区间随之作废
+static alloc_stats_t astats;
+
+static int order_of(uint len)
+{
+    return min(31 - __builtin_clz(len), ALLOC_ORDERS - 1);
+}
+
+// 第一个结束位置大于 x 的区间 (包含 x 或在 x 之后), 都不满足时返回 fext_n
+static int fext_search(uint x)
 {
-    uint bno = block_bitmap_find_free();
-    if (bno == 0)
+    int lo = 0, hi = fext_n;
+    while (lo < hi)
     {
-        Error("alloc_block: no free blocks available");
+        int mid = (lo + hi) / 2;
+        if (fext[mid].start + fext[mid].len <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int fext_insert_at(int i, uint start, uint len)
+{
+    if (fext_n == fext_cap)
+    {
+        int cap = fext_cap ? fext_cap * 2 : 256;
+        free_extent *p = realloc(fext, cap * sizeof(free_extent));
+        if (p == NULL)
+        {
+            Error("fext_insert_at: out of memory for %d free extents", cap);
+            return -1;
+        }
+        fext = p;
+        fext_cap = cap;
+    }
+    memmove(&fext[i + 1], &fext[i], (fext_n - i) * sizeof(free_extent));
+    fext[i].start = start;
+    fext[i].len = len;
+    fext_hist[order_of(len)]++;
+    fext_n++;
+    return 0;
+}
+
+static void fext_set_len(int i, uint start, uint len)
+{
+    fext_hist[order_of(fext[i].len)]--;
+    fext[i].start = start;
+    fext[i].len = len;
+    fext_hist[order_of(len)]++;
+}
+
+static void fext_remove_at(int i)
+{
+    fext_hist[order_of(fext[i].len)]--;
+    memmove(&fext[i], &fext[i + 1], (fext_n - i - 1) * sizeof(free_extent));
+    fext_n--;
+}
+
+// 把 [start, start+len) 加入空闲区间, 与前后相邻的区间合并
+static void fext_add(uint start, uint len)
+{
+    int i = fext_search(start);
+    int prev = i > 0 && fext[i - 1].start + fext[i - 1].len == start;
+    int next = i < fext_n && fext[i].start == start + len;
+    if (prev && next)
+    {
+        fext_set_len(i - 1, fext[i - 1].start, fext[i - 1].len + len + fext[i].len);
+        fext_remove_at(i);
+    }
+    else if (prev)
+        fext_set_len(i - 1, fext[i - 1].start, fext[i - 1].len + len);
+    else if (next)
+        fext_set_len(i, start, fext[i].len + len);
+    else if (fext_insert_at(i, start, len) < 0)
+    {
+        fext_loaded = 0; // 内存不足, 下次分配时重建
+        return;
+    }
+    fext_free += len;
+}
+
+// 从第 i 个区间中取出 [start, start+len), 剩下的头尾部分仍是空闲区间
+static void fext_take(int i, uint start, uint len)
+{
+    uint head = start - fext[i].start;
+    uint tail = fext[i].start + fext[i].len - (start + len);
+    if (head && tail)
+    {
+        fext_set_len(i, fext[i].start, head);
+        if (fext_insert_at(i + 1, start + len, tail) < 0)
+            fext_loaded = 0;
+    }
+    else if (head)
+        fext_set_len(i, fext[i].start, head);
+    else if (tail)
+        fext_set_len(i, start + len, tail);
+    else
+        fext_remove_at(i);
+    fext_free -= len;
+}
+
+// 由位图重建空闲区间 (调用者持有 alloc_lock)
+static int fext_rebuild(void)
+{
+    fext_n = 0;
+    fext_free = 0;
+    memset(fext_hist, 0, sizeof(fext_hist));
+    uint item = sb.datastart, start;
+    int len;
+    while ((len = bitmap_next_free_run(BITMAP_BLOCK, item, &start)) > 0)
+    {
+        if (fext_insert_at(fext_n, start, len) < 0)
+            return -1;
+        fext_free += len;
+        item = start + len;
+    }
+    fext_size = sb.size;
+    fext_datastart = sb.datastart;
+    alloc_hint = sb.datastart;
+    fext_loaded = 1;
+    resv_gen++;
+    astats.reserved = 0;
+    Log("alloc: rebuilt %d free extents (%d free blocks) from the block bitmap", fext_n, fext_free);
+    return 0;
+}
+
+// 在 goal 附近分配最多 want 个连续块 (调用者持有 alloc_lock):
+// goal 所在的空闲区间够长时从 goal 开始, 否则取 goal 之后 (到末尾后回绕) 第一个足够长的区间,
+// 没有足够长的区间时取最长的区间; 返回分配的块数
+static uint fext_alloc(uint goal, uint want, uint *start)
+{
+    if (fext_n == 0)
+        return 0;
+    int i0 = fext_search(goal);
+    if (i0 == fext_n)
+        i0 = 0;
+    if (fext[i0].start <= goal && fext[i0].start + fext[i0].len - goal >= want)
+    {
+        *start = goal;
+        fext_take(i0, goal, want);
+        return want;
+    }
+
+    // 直方图里没有可能够长的区间时不必扫描
+    int fits = 0;
+    for (int o = order_of(want); o < ALLOC_ORDERS && !fits; o++)
+        fits = fext_hist[o] > 0;
+    int best = i0;
+    for (int k = 0; fits && k < fext_n; k++)
+    {
+        int i = (i0 + k) % fext_n;
+        if (fext[i].len >= want)
+        {
+            *start = fext[i].start;
+            fext_take(i, *start, want);
+            return want;
+        }
+    }
+    for (int i = 0; i < fext_n; i++)
+    {
+        if (fext[i].len > fext[best].len)
+            best = i;
+    }
+    uint n = fext[best].len;
+    *start = fext[best].start;
+    fext_take(best, *start, n);
+    return n;
+}
+
+// 确保空闲区间可用, 布局变化 (格式化) 后重建 (调用者持有 alloc_lock)
+static int fext_ready(void)
+{
+    if (fext_loaded && fext_size == sb.size && fext_datastart == sb.datastart)
         return 0;
+    return fext_rebuild();
+}
+
+static long elapsed_ns(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000000000L + (t1.tv_nsec - t0->tv_nsec);
+}
+
+// 分配最多 want 个连续块并在位图中标记; next_fit 为 1 时忽略 goal, 从上一次单块分配之后开始
+static uint alloc_run(uint goal, uint want, uint *start, int next_fit)
+{
+    struct timespec t0;
+    pthread_mutex_lock(&alloc_lock);
+    if (fext_ready() < 0)
+    {
+        pthread_mutex_unlock(&alloc_lock);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0); // 不计入重建的时间
+    if (next_fit)
+        goal = alloc_hint;
+    if (goal < sb.datastart || goal >= sb.size)
+        goal = sb.datastart;
+    uint n = fext_alloc(goal, want, start);
+    if (n > 0)
+    {
+        bitmap_set_range(BITMAP_BLOCK, *start, n, 1);
+        if (next_fit)
+            alloc_hint = *start + n;
+        astats.allocs++;
+        astats.blocks += n;
+        if (*start == goal)
+            astats.near_hits++;
+        if (n < want)
+            astats.short_allocs++;
     }
+    long ns = elapsed_ns(&t0);
+    astats.total_ns += ns;
+    if (ns > astats.max_ns)
+        astats.max_ns = ns;
+    pthread_mutex_unlock(&alloc_lock);
+    return n;
+}
 
-    if (block_bitmap_set_used(bno) < 0)
+// 分配一个块并清零 (元数据块)
+uint allocate_block()
+{
+    uint bno;
+    if (alloc_run(0, 1, &bno, 1) == 0)
     {
-        Error("alloc_block: failed to mark block %d as used", bno);
+        Error("alloc_block: no free blocks available");
         return 0;
     }
 
@@ -66,37 +346,214 @@ uint allocate_block()
     return bno;
 }
 
+// 分配一个块但不清零, 用于随后会被写入的数据块
+// 在第一次写入前读取该块得到全零, 不完整的写入不会暴露块中的旧数据
+uint allocate_block_uninit()
+{
+    uint bno;
+    if (alloc_run(0, 1, &bno, 1) == 0)
+    {
+        Error("alloc_block: no free blocks available");
+        return 0;
+    }
+    set_uninit(bno);
+    __sync_fetch_and_add(&zero_writes_saved, 1);
+    Log("alloc_block: allocated block %d (uninitialized)", bno);
+    return bno;
+}
+
+// 优先分配 goal 块 (用于让文件保持物理连续), 不可用时取 goal 之后最近的空闲块
+uint allocate_block_near(uint goal)
+{
+    uint bno;
+    if (alloc_run(goal, 1, &bno, 0) == 0)
+    {
+        Error("alloc_block: no free blocks available");
+        return 0;
+    }
+    set_uninit(bno);
+    __sync_fetch_and_add(&zero_writes_saved, 1);
+    Log("alloc_block: allocated block %d (goal %d)", bno, goal);
+    return bno;
+}
+
+// 在 goal 附近一次分配最多 want 个物理连续的块, 返回分配的块数 (0 表示没有空闲块)
+// 新块不清零, 调用者必须在建立映射的同一次操作中整块写入 (不满一块的部分自行补零) 或调用 zero_blocks
+uint allocate_blocks(uint goal, uint want, uint *start)
+{
+    uint n = alloc_run(goal, want, start, 0);
+    if (n == 0)
+    {
+        Error("alloc_blocks: no free blocks available");
+        return 0;
+    }
+    for (uint i = 0; i < n; i++)
+        set_uninit(*start + i);
+    __sync_fetch_and_add(&zero_writes_saved, n);
+    Log("alloc_blocks: allocated %d blocks at %d (wanted %d)", n, *start, want);
+    return n;
+}
+
+// 为一个写入流预留最多 want 个连续块: 只从空闲区间中取出, 不修改位图, 也不会持久化
+// goal 空闲时从 goal 开始 (让文件保持连续), 否则按 fext_alloc 的规则选择区间
+// 返回预留的块数, *gen 记录当前的区间版本, 重建空闲区间后旧的预留失效
+uint reserve_blocks(uint goal, uint want, uint *start, uint *gen)
+{
+    pthread_mutex_lock(&alloc_lock);
+    if (fext_ready() < 0)
+    {
+        pthread_mutex_unlock(&alloc_lock);
+        return 0;
+    }
+    if (goal < sb.datastart || goal >= sb.size)
+        goal = sb.datastart;
+    uint n = 0;
+    int i = fext_search(goal);
+    if (i < fext_n && fext[i].start <= goal)
+    {
+        n = min(want, fext[i].start + fext[i].len - goal);
+        *start = goal;
+        fext_take(i, goal, n);
+    }
+    else
+    {
+        n = fext_alloc(goal, want, start);
+    }
+    if (n > 0)
+    {
+        astats.reserved += n;
+        astats.windows++;
+    }
+    *gen = resv_gen;
+    pthread_mutex_unlock(&alloc_lock);
+    Log("reserve_blocks: reserved %d blocks at %d (goal %d, wanted %d)", n, n ? *start : 0, goal, want);
+    return n;
+}
+
+// 把预留区间开头的 n 个块转为已分配 (标记位图, 新块不清零), 预留已失效时返回 -1
+int claim_reserved(uint start, uint n, uint gen)
+{
+    pthread_mutex_lock(&alloc_lock);
+    if (fext_ready() < 0 || gen != resv_gen)
+    {
+        pthread_mutex_unlock(&alloc_lock);
+        return -1;
+    }
+    bitmap_set_range(BITMAP_BLOCK, start, n, 1);
+    astats.reserved -= n;
+    astats.allocs++;
+    astats.blocks += n;
+    astats.resv_blocks += n;
+    pthread_mutex_unlock(&alloc_lock);
+    for (uint i = 0; i < n; i++)
+        set_uninit(start + i);
+    __sync_fetch_and_add(&zero_writes_saved, n);
+    return 0;
+}
+
+// 归还没有用完的预留块
+void release_reserved(uint start, uint n, uint gen)
+{
+    if (n == 0)
+        return;
+    pthread_mutex_lock(&alloc_lock);
+    if (gen == resv_gen && fext_loaded)
+    {
+        fext_add(start, n);
+        astats.reserved -= n;
+        astats.resv_released += n;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    Log("release_reserved: returned %d reserved blocks at %d", n, start);
+}
+
 void free_block(uint bno)
 {
-    if (bno < sb.datastart || bno >= sb.size)
+    if (bno < sb.datastart || bno >= sb.size || cg_meta_block(bno))
     {
         Error("free_block: blockno %d out of range", bno);
         return;
     }
+    pthread_mutex_lock(&alloc_lock);
     // 检查是否已经空闲
     int used = block_bitmap_is_used(bno);
     if (used < 0)
     {
+        pthread_mutex_unlock(&alloc_lock);
         Error("free_block: invalid block number %d", bno);
         return;
     }
     if (!used)
     {
+        pthread_mutex_unlock(&alloc_lock);
         Warn("free_block: block %d already free", bno);
         return;
     }
 
+    // 块变为可分配之前处理旧内容: 之后其他线程 (回收线程与请求线程) 可能马上重新分配并写入
+#if BLOCK_ZERO_ON_FREE
+    zero_block(bno); // 清零块内容
+#else
+    // 只标记空闲: 缓存中的副本直接丢弃, 未写回的脏数据不再写盘
+    cache_discard(bno);
+    __sync_fetch_and_add(&zero_writes_saved, 1);
+#endif
+    clear_uninit(bno);
+
     // 标记为空闲
     if (block_bitmap_set_free(bno) < 0)
     {
+        pthread_mutex_unlock(&alloc_lock);
         Error("free_block: failed to free block %d", bno);
         return;
     }
-
-    zero_block(bno); // 清零块内容
+    if (fext_loaded)
+        fext_add(bno, 1);
+    astats.frees++;
+    pthread_mutex_unlock(&alloc_lock);
     Log("free_block: block %d freed", bno);
 }
 
+// 分配器统计 (空闲区间的数量和分布、分配次数和耗时)
+void alloc_get_stats(alloc_stats_t *st)
+{
+    pthread_mutex_lock(&alloc_lock);
+    *st = astats;
+    st->free_blocks = fext_loaded ? fext_free : 0;
+    st->free_extents = fext_loaded ? fext_n : 0;
+    st->largest = 0;
+    for (int i = 0; fext_loaded && i < fext_n; i++)
+    {
+        if (fext[i].len > st->largest)
+            st->largest = fext[i].len;
+    }
+    memcpy(st->hist, fext_hist, sizeof(st->hist));
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+int alloc_format_stats(char *out, int size)
+{
+    alloc_stats_t st;
+    alloc_get_stats(&st);
+    int n = snprintf(out, size, "free %u blocks in %d extents, largest %u, fragmentation %.1f%%\n", st.free_blocks,
+                     st.free_extents, st.largest, st.free_blocks ? 100.0 * (st.free_blocks - st.largest) / st.free_blocks : 0.0);
+    if (n < size)
+        n += snprintf(out + n, size - n, "extent sizes:");
+    for (int o = 0; o < ALLOC_ORDERS && n < size; o++)
+    {
+        if (st.hist[o])
+            n += snprintf(out + n, size - n, " %u%s:%d", 1u << o, o == ALLOC_ORDERS - 1 ? "+" : "", st.hist[o]);
+    }
+    if (n < size)
+        n += snprintf(out + n, size - n, "\nallocs %ld (%ld blocks, %ld at goal, %ld short) frees %ld, avg %.0f ns max %ld ns",
+                      st.allocs, st.blocks, st.near_hits, st.short_allocs, st.frees,
+                      st.allocs ? (double)st.total_ns / st.allocs : 0.0, st.max_ns);
+    if (n < size)
+        n += snprintf(out + n, size - n, "\nprealloc: %u blocks reserved, %ld windows, %ld blocks used, %ld returned",
+                      st.reserved, st.windows, st.resv_blocks, st.resv_released);
+    return n < size ? n : size - 1;
+}
+
 void get_disk_info(int *ncyl_, int *nsec_)
 {
     if (!disk_client)
@@ -107,10 +564,11 @@ void get_disk_info(int *ncyl_, int *nsec_)
 
     // 发送 "I" 命令获取磁盘信息
     char cmd[] = "I";
-    client_send(disk_client, cmd, strlen(cmd) + 1);
-
     char response[256];
+    pthread_mutex_lock(&disk_lock);
+    client_send(disk_client, cmd, strlen(cmd) + 1);
     int n = client_recv(disk_client, response, sizeof(response));
+    pthread_mutex_unlock(&disk_lock);
     response[n] = '\0';
 
     // 解析响应："ncyl nsec"
@@ -125,6 +583,12 @@ void get_disk_info(int *ncyl_, int *nsec_)
 // 将块号转换为柱面/扇区的函数
 void block_to_cyl_sec(int blockno, int *cyl, int *sec)
 {
+    if (nsec <= 0) // 尚未获取磁盘信息 (如单元测试)
+    {
+        *cyl = 0;
+        *sec = blockno;
+        return;
+    }
     *cyl = blockno / nsec;
     *sec = blockno % nsec;
 }
@@ -134,6 +598,7 @@ void raw_read_block(int blockno, uchar *buf)
     if (!disk_client)
     {
         Error("Disk client not initialized");
+        memset(buf, 0, BSIZE);
         return;
     }
 
@@ -143,10 +608,13 @@ void raw_read_block(int blockno, uchar *buf)
     // 发送读命令 "R cyl sec"
     char cmd[256];
     snprintf(cmd, sizeof(cmd), "R %d %d", cyl, sec);
-    client_send(disk_client, cmd, strlen(cmd) + 1);
 
     char response[1024]; 
+    pthread_mutex_lock(&disk_lock);
+    client_send(disk_client, cmd, strlen(cmd) + 1);
     int n = client_recv(disk_client, response, sizeof(response));
+    head_cyl = cyl;
+    pthread_mutex_unlock(&disk_lock);
 
     // 检查响应格式
     if (n > 3 && strncmp(response, "Yes", 3) == 0)
@@ -187,10 +655,12 @@ void raw_write_block(int blockno, uchar *buf)
     int header_len = snprintf(cmd, sizeof(cmd), "W %d %d %d ", cyl, sec, BSIZE);
     memcpy(cmd + header_len, buf, BSIZE);
 
-    client_send(disk_client, cmd, header_len + BSIZE);
-
     char response[256];
+    pthread_mutex_lock(&disk_lock);
+    client_send(disk_client, cmd, header_len + BSIZE);
     int n = client_recv(disk_client, response, sizeof(response));
+    head_cyl = cyl;
+    pthread_mutex_unlock(&disk_lock);
     response[n] = '\0';
 
     if (strncmp(response, "Yes", 3) == 0)
@@ -203,20 +673,249 @@ void raw_write_block(int blockno, uchar *buf)
     }
 }
 
+// 一次请求写入连续的多个块 (最多 MAX_IO_BLOCKS 块)
+void raw_write_blocks(int blockno, int nblocks, uchar *buf)
+{
+    if (nblocks == 1)
+    {
+        raw_write_block(blockno, buf);
+        return;
+    }
+    if (!disk_client)
+    {
+        Error("Disk client not initialized");
+        return;
+    }
+    if (nblocks <= 0 || nblocks > MAX_IO_BLOCKS)
+    {
+        Error("write_blocks: invalid block count %d", nblocks);
+        return;
+    }
+
+    int cyl, sec, last_cyl, last_sec;
+    block_to_cyl_sec(blockno, &cyl, &sec);
+    block_to_cyl_sec(blockno + nblocks - 1, &last_cyl, &last_sec);
+
+    // 发送多块写命令 "WM cyl sec nblocks data"
+    char cmd[TCP_BUF_SIZE];
+    int header_len = snprintf(cmd, sizeof(cmd), "WM %d %d %d ", cyl, sec, nblocks);
+    memcpy(cmd + header_len, buf, nblocks * BSIZE);
+
+    char response[256];
+    pthread_mutex_lock(&disk_lock);
+    client_send(disk_client, cmd, header_len + nblocks * BSIZE);
+    int n = client_recv(disk_client, response, sizeof(response));
+    head_cyl = last_cyl;
+    pthread_mutex_unlock(&disk_lock);
+    response[n] = '\0';
+
+    if (strncmp(response, "Yes", 3) != 0)
+    {
+        Error("write_blocks: failed for blocks %d-%d, response: %s", blockno, blockno + nblocks - 1, response);
+    }
+}
+
+// 一次请求读取连续的多个块 (最多 MAX_IO_BLOCKS 块), 成功返回 0
+int raw_read_blocks(int blockno, int nblocks, uchar *buf)
+{
+    if (!disk_client)
+    {
+        Error("Disk client not initialized");
+        return -1;
+    }
+    if (nblocks <= 0 || nblocks > MAX_IO_BLOCKS)
+    {
+        Error("read_blocks: invalid block count %d", nblocks);
+        return -1;
+    }
+
+    int cyl, sec, last_cyl, last_sec;
+    block_to_cyl_sec(blockno, &cyl, &sec);
+    block_to_cyl_sec(blockno + nblocks - 1, &last_cyl, &last_sec);
+
+    // 发送多块读命令 "RM cyl sec nblocks"
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "RM %d %d %d", cyl, sec, nblocks);
+
+    char response[TCP_BUF_SIZE];
+    pthread_mutex_lock(&disk_lock);
+    client_send(disk_client, cmd, strlen(cmd) + 1);
+    int n = client_recv(disk_client, response, sizeof(response));
+    head_cyl = last_cyl;
+    pthread_mutex_unlock(&disk_lock);
+
+    if (n >= 4 + nblocks * BSIZE && strncmp(response, "Yes", 3) == 0)
+    {
+        memcpy(buf, response + 4, nblocks * BSIZE);
+        return 0;
+    }
+    Error("read_blocks: failed for blocks %d-%d", blockno, blockno + nblocks - 1);
+    return -1;
+}
+
+// 模拟的磁头当前所在柱面
+int disk_head_cyl(void)
+{
+    pthread_mutex_lock(&disk_lock);
+    int cyl = head_cyl;
+    pthread_mutex_unlock(&disk_lock);
+    return cyl;
+}
+
+// 柱面组数, 未使用柱面组时为 0
+uint cg_count(void)
+{
+    return (sb.features & FEAT_CGROUPS) ? sb.ncg : 0;
+}
+
+uint cg_of_block(uint bno)
+{
+    return bno / sb.cgblocks;
+}
+
+uint cg_start(uint g)
+{
+    return g * sb.cgblocks;
+}
+
+uint cg_bmap_block(uint g)
+{
+    return cg_start(g) + (g == 0); // 组 0 的第一个块是超级块
+}
+
+uint cg_ibmap_block(uint g)
+{
+    return cg_bmap_block(g) + 1;
+}
+
+uint cg_inode_start(uint g)
+{
+    return cg_ibmap_block(g) + 1;
+}
+
+// 组内第一个数据块 (组 0 的 inode 表之后还有日志区)
+uint cg_data_start(uint g)
+{
+    return g == 0 ? sb.inodestart + sb.cgiblocks + sb.nlog : cg_inode_start(g) + sb.cgiblocks;
+}
+
+uint cg_end(uint g)
+{
+    return min(cg_start(g) + sb.cgblocks, sb.size);
+}
+
+// 块是否属于某个柱面组的元数据 (位图、inode 表、日志)
+static int cg_meta_block(uint b)
+{
+    if (cg_count() == 0)
+        return b < sb.datastart;
+    uint g = cg_of_block(b);
+    return g < sb.ncg && b < cg_data_start(g);
+}
+
+// 根据超级块布局确定块类别, 布局之外的块由调用者给出 (hint)
+int block_class(int blockno, int hint)
+{
+    uint b = blockno;
+    if (b == 0)
+        return BC_SUPER;
+    if (cg_count() > 0)
+    {
+        uint g = cg_of_block(b);
+        if (g >= sb.ncg || b >= cg_data_start(g))
+            return hint;
+        if (b < cg_inode_start(g))
+            return BC_BITMAP;
+        if (b < cg_inode_start(g) + sb.cgiblocks)
+            return BC_INODE;
+        return BC_LOG;
+    }
+    if (sb.size == 0 || b >= sb.datastart)
+        return hint;
+    if (b >= sb.bmapstart && b < sb.bmapstart + sb.bmapblocks)
+        return BC_BITMAP;
+    if (b >= sb.inodebmapstart && b < sb.inodebmapstart + sb.inodebmapblocks)
+        return BC_BITMAP;
+    if (b >= sb.inodestart && b < sb.logstart)
+        return BC_INODE;
+    if (b >= sb.logstart && b < sb.logstart + sb.nlog)
+        return BC_LOG;
+    return hint;
+}
+
+const char *block_class_name(int cls)
+{
+    static const char *names[BC_NCLASS] = {"super", "bitmap", "inode", "log", "dir", "indirect", "data"};
+    return cls >= 0 && cls < BC_NCLASS ? names[cls] : "unknown";
+}
+
 // 修改 read_block 函数使用缓存
 void read_block(int blockno, uchar *buf)
 {
-    cached_read_block(blockno, buf);
+    read_block_as(blockno, buf, BC_DATA);
+}
+
+// 顺序扫描的数据块, 不挤占热块的缓存位置
+void read_block_stream(int blockno, uchar *buf)
+{
+    if (block_uninit(blockno))
+    {
+        memset(buf, 0, BSIZE);
+        return;
+    }
+    cached_read_block_stream(blockno, buf);
 }
 
 // 修改 write_block 函数使用缓存
 void write_block(int blockno, uchar *buf)
 {
-    cached_write_block(blockno, buf);
+    write_block_as(blockno, buf, BC_DATA);
+}
+
+// 预取一组块到缓存
+void prefetch_blocks(const uint *blocks, int n, int cls)
+{
+    cache_prefetch(blocks, n, cls);
+}
+
+// 块是否已在缓存中
+int block_cached(int blockno)
+{
+    return cache_contains(blockno);
+}
+
+// 按类别读块, 元数据区域内的块以布局为准
+void read_block_as(int blockno, uchar *buf, int cls)
+{
+    if (block_uninit(blockno))
+    {
+        memset(buf, 0, BSIZE); // 还没写过的块, 不读盘
+        return;
+    }
+    cached_read_block(blockno, buf, block_class(blockno, cls));
+}
+
+// 按类别写块, 元数据区域内的块以布局为准
+void write_block_as(int blockno, uchar *buf, int cls)
+{
+    clear_uninit(blockno);
+    cached_write_block(blockno, buf, block_class(blockno, cls));
+}
+
+// 写入连续的多个块 (数据区内的块, 类别由调用者给出)
+void write_blocks_as(int blockno, int nblocks, uchar *buf, int cls)
+{
+    for (int i = 0; i < nblocks; i++)
+        clear_uninit(blockno + i);
+    cached_write_blocks(blockno, nblocks, buf, block_class(blockno, cls));
 }
 
 void init_block_bitmap()
 {
+    memset(uninit_map, 0, sizeof(uninit_map));
+    pthread_mutex_lock(&alloc_lock);
+    fext_loaded = 0; // 空闲区间在下一次分配时由新位图重建
+    pthread_mutex_unlock(&alloc_lock);
     // 清空所有数据块位图
     if (bitmap_clear_all(BITMAP_BLOCK) < 0)
     {
@@ -64,7 +64,7 @@ int handle_local_command(const char *cmd, client_state *state)
     if (strcmp(cmd, "help") == 0)
     {
         printf("Available commands:\n");
-        printf("  f                    - Format file system\n");
+        printf("  f [extents|blockmap|flat] - Format file system (flat: no cylinder groups)\n");
         printf("  mk <name>            - Create file\n");
         printf("  mkdir <name>         - Create directory\n");
         printf("  rm <name>            - Remove file\n");
@@ -72,13 +72,21 @@ int handle_local_command(const char *cmd, client_state *state)
         printf("  cd <path>            - Change directory\n");
         printf("  ls                   - List directory contents\n");
         printf("  cat <name>           - Display file contents\n");
+        printf("  read <name> <off> <len> - Display len bytes of file from offset\n");
         printf("  w <name> <len> <data> - Write to file\n");
         printf("  i <name> <pos> <len> <data> - Insert into file\n");
         printf("  d <name> <pos> <len> - Delete from file\n");
+        printf("  pwrite <name> <off> <len> <data> - Overwrite file bytes at offset\n");
+        printf("  append <name> <len> <data> - Append to end of file\n");
+        printf("  fallocate <name> <len> - Preallocate space for file (size unchanged)\n");
+        printf("  pieces <name> on|off - Keep file as a piece table for cheap i/d edits\n");
         printf("  login <uid>          - Login as user\n");
         printf("  adduser <uid>        - Add new user (admin only)\n");
         printf("  pwd                  - Show current directory\n");
         printf("  whoami               - Show current user\n");
+        printf("  sync [cmd]           - Flush dirty blocks (or run cmd synchronously)\n");
+        printf("  cachestat            - Show cache statistics (admin only)\n");
+        printf("  allocstat            - Show free space and allocator statistics (admin only)\n");
         printf("  e                    - Exit\n");
         printf("  help                 - Show this help\n");
         return 1;
@@ -196,9 +204,26 @@ int main(int argc, char *argv[])
 
         client_send(client, buf, strlen(buf) + 1);
 
-        // 接收并处理响应
-        int n = client_recv(client, buf, sizeof(buf));
+        // 接收并处理响应; 流式回复 (cat/read) 先收到若干 "More" 包, 边收边输出
+        int n = client_recv(client, buf, sizeof(buf) - 1);
         buf[n] = '\0';
+        int streamed = 0;
+        while (strncmp(buf, "More ", 5) == 0)
+        {
+            if (!streamed)
+                printf("YES\n");
+            fwrite(buf + 5, 1, n - 5, stdout);
+            streamed = 1;
+            n = client_recv(client, buf, sizeof(buf) - 1);
+            buf[n] = '\0';
+        }
+        if (streamed && strncmp(buf, "Yes", 3) == 0)
+        {
+            printf("\n");
+            continue;
+        }
+        if (streamed)
+            printf("\n");
 
         handle_response(buf, last_cmd, &state);
 
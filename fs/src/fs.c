@@ -10,11 +10,13 @@
 #include "block.h"
 #include "log.h"
 #include "bitmap.h"
+#include "orphan.h"
 #include "user.h"
 
 uint current_dir = 0;                 // 当前目录的 inode 编号
 uint current_uid = 0;                 // 当前用户的 UID
 static char current_path[1024] = "/"; // 当前路径
+static __thread int sync_request = 0; // 当前请求是否要求同步写回 (每个处理线程各自一份)
 
 // 全局读写锁
 static pthread_rwlock_t fs_rwlock = PTHREAD_RWLOCK_INITIALIZER;
@@ -24,6 +26,28 @@ static pthread_rwlock_t fs_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 #define FS_WRITE_LOCK() pthread_rwlock_wrlock(&fs_rwlock)
 #define FS_UNLOCK() pthread_rwlock_unlock(&fs_rwlock)
 
+// 文件系统锁: 请求线程在整条命令期间持有, 后台线程拿到锁后才能分配块或修改 inode
+void fs_lock(void)
+{
+    FS_WRITE_LOCK();
+}
+
+void fs_unlock(void)
+{
+    FS_UNLOCK();
+}
+
+// 写回线程每个周期调用: 没有命令在执行时, 把到期的延迟块分配并写入缓存, 之后随其他脏块到期写回
+// 否则留给该命令结束时的 fs_commit
+static void fs_writeback_hook(void)
+{
+    if (pthread_rwlock_trywrlock(&fs_rwlock) != 0)
+        return;
+    delalloc_flush(0);
+    bitmap_sync();
+    FS_UNLOCK();
+}
+
 void sbinit(int ncyl_, int nsec_)
 {
     uchar buf[BSIZE];
@@ -31,9 +55,46 @@ void sbinit(int ncyl_, int nsec_)
     memcpy(&sb, buf, sizeof(sb));
     if (sb.magic != MAGIC)
     {
+        sb.norphan = 0;      // 未格式化的磁盘上没有可信的孤儿表
         cmd_f(ncyl_, nsec_); // 格式化文件系统
     }
+    else if (sb.norphan > 0)
+    {
+        Log("sbinit: %d orphan inodes left from the last run will be reclaimed", sb.norphan);
+    }
     cache_init();        // 初始化缓存系统
+    cache_set_writeback_hook(fs_writeback_hook); // 最后一条命令之后写入的延迟块也会到期落盘
+}
+
+// 设置当前请求的同步标志
+void fs_set_sync(int sync)
+{
+    sync_request = sync;
+}
+
+// 把所有脏块同步写回磁盘
+int fs_sync(void)
+{
+    delalloc_flush(1);
+    bitmap_sync();
+    cache_flush();
+    return E_SUCCESS;
+}
+
+// 写命令完成时调用: 有后台写回线程时由其负责落盘, 除非请求要求同步
+static void fs_commit(void)
+{
+    int sync = sync_request || !cache_writeback_active();
+    piece_compact_pending(); // 片段太多的文件压缩回平坦布局
+    delalloc_flush(sync); // 同步写回时延迟块全部分配并写入, 否则只写回过期的
+    if (!reclaim_active())
+        reclaim_drain(); // 没有回收线程时删除的文件在命令结束前回收
+    bitmap_sync();        // 本次命令修改过的位图块放入缓存
+    prealloc_release_idle();
+    if (sync)
+    {
+        cache_flush();
+    }
 }
 char *get_current_path(void)
 {
@@ -68,6 +129,12 @@ void update_current_path(const char *path)
 }
 
 int cmd_f(int ncyl, int nsec)
+{
+    return cmd_format(ncyl, nsec, FS_DEFAULT_FEATURES);
+}
+
+// 按指定特性格式化 (FEAT_EXTENTS: 新文件使用 extent 映射)
+int cmd_format(int ncyl, int nsec, uint features)
 {
     if (current_uid != ADMIN_UID)
     {
@@ -75,7 +142,8 @@ int cmd_f(int ncyl, int nsec)
         return E_ERROR;
     }
     int size = ncyl * nsec;
-    init_sb(size);         // 初始化超级块
+    reclaim_drain();         // 旧文件系统的孤儿回收完后再重建
+    init_sb(size, features); // 初始化超级块
     init_block_bitmap();   // 初始化数据块位图
     init_inode_system();   // 初始化inode位图和inode区域
     init_root_directory(); // 初始化根目录
@@ -90,7 +158,10 @@ int cmd_f(int ncyl, int nsec)
     }
 
     Log("File system formatted successfully");
-    Log("Total blocks: %d, Data blocks: %d, Inodes: %d", sb.size, sb.ndatablocks, sb.ninodes);
+    Log("Total blocks: %d, Data blocks: %d, Inodes: %d, features 0x%x", sb.size, sb.ndatablocks, sb.ninodes,
+        sb.features);
+    delalloc_flush(1);
+    bitmap_sync();
     cache_flush();
     return E_SUCCESS;
 }
@@ -129,7 +200,7 @@ int cmd_mk(char *name, short mode)
     }
 
     // 分配新的 inode
-    inode *ip = ialloc(T_FILE);
+    inode *ip = ialloc_in(T_FILE, current_dir);
     if (ip == NULL)
     {
         Error("cmd_mk: failed to allocate inode for file '%s'", name);
@@ -159,7 +230,7 @@ int cmd_mk(char *name, short mode)
 
     Log("cmd_mk: successfully created file '%s' with inode %d", name, ip->inum);
     iput(ip);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
@@ -197,7 +268,7 @@ int cmd_mkdir(char *name, short mode)
     }
 
     // 分配新的 inode
-    inode *ip = ialloc(T_DIR);
+    inode *ip = ialloc_in(T_DIR, current_dir);
     if (ip == NULL)
     {
         Error("cmd_mkdir: failed to allocate inode for directory '%s'", name);
@@ -214,7 +285,7 @@ int cmd_mkdir(char *name, short mode)
     ip->dirty = 1;
 
     // 为新目录分配数据块
-    uint dir_data_block = allocate_block();
+    uint dir_data_block = bmap(ip, 0);
     if (dir_data_block == 0)
     {
         Error("cmd_mkdir: no free blocks available for directory '%s'", name);
@@ -222,7 +293,6 @@ int cmd_mkdir(char *name, short mode)
 
         return E_ERROR;
     }
-    ip->addrs[0] = dir_data_block;
 
     iupdate(ip);
 
@@ -259,7 +329,7 @@ int cmd_mkdir(char *name, short mode)
 
     Log("cmd_mkdir: successfully created directory '%s' with inode %d", name, ip->inum);
     iput(ip);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
@@ -306,7 +376,17 @@ int cmd_rm(char *name)
         return E_ERROR;
     }
 
+    // 先从父目录中删除条目; 失败时文件仍然可以访问, 不能再释放或交给回收线程
+    if (remove_entry_from_directory(current_dir, name) < 0)
+    {
+        Error("cmd_rm: failed to remove file from directory");
+        iput(file_ip);
+
+        return E_ERROR;
+    }
+
     // 检查文件是否有其他硬链接
+    int orphan = 0;
     if (file_ip->nlink > 1)
     { // 只是减少链接数，不删除实际数据
         file_ip->nlink--;
@@ -314,7 +394,16 @@ int cmd_rm(char *name)
         iupdate(file_ip);
         Log("cmd_rm: decreased link count for file '%s' to %d", name, file_ip->nlink);
     }
-    else // 最后一个链接，删除文件数据
+    else if (!orphan_full())
+    {
+        // 最后一个链接: 标记为孤儿并记入孤儿表, 数据块由后台回收线程分批释放, 删除不随文件大小变慢
+        file_ip->nlink = 0;
+        file_ip->flags |= IF_ORPHAN;
+        file_ip->dirty = 1;
+        iupdate(file_ip);
+        orphan = 1;
+    }
+    else // 孤儿表已满, 同步删除文件数据
     {
         Log("cmd_rm: freeing file data for '%s'", name);
 
@@ -328,18 +417,14 @@ int cmd_rm(char *name)
         free_inode_in_bitmap(file_inum);
     }
 
-    iput(file_ip);
-
-    // 从父目录中删除条目
-    int result = remove_entry_from_directory(current_dir, name);
-    if (result < 0)
+    iput(file_ip); // 孤儿 inode 在这里只丢弃还没有分配的延迟块和预留窗口
+    if (orphan)
     {
-        Error("cmd_rm: failed to remove file from directory");
-
-        return E_ERROR;
+        orphan_add(file_inum); // 目录项已删除, 交给回收线程
+        Log("cmd_rm: '%s' queued for background reclamation", name);
     }
     Log("cmd_rm: successfully removed file '%s'", name);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
@@ -446,7 +531,7 @@ int cmd_rmdir(char *name)
     }
 
     Log("cmd_rmdir: successfully removed directory '%s'", name);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
@@ -735,6 +820,63 @@ int cmd_cat(char *name, uchar **buf, uint *len)
     return E_SUCCESS;
 }
 
+// 读取 [off, off + len) (不超过文件尾), 每 READ_CHUNK 字节交给 emit 一次, 不按文件大小分配内存
+int cmd_read(char *name, uint off, uint len, read_emit_fn emit, void *arg)
+{
+    if (name == NULL || strlen(name) == 0 || emit == NULL)
+    {
+        Error("cmd_read: invalid parameters");
+        return E_ERROR;
+    }
+    uint file_inum = find_entry_in_directory(current_dir, name, T_FILE);
+    if (file_inum == 0)
+    {
+        Error("cmd_read: file '%s' not found", name);
+        return E_ERROR;
+    }
+    if (!check_file_permission(file_inum, current_uid, PERM_READ))
+    {
+        Error("cmd_read: no permission to read file '%s'", name);
+        return E_ERROR;
+    }
+    inode *file_ip = iget(file_inum);
+    if (file_ip == NULL)
+    {
+        Error("cmd_read: failed to get file inode %d", file_inum);
+        return E_ERROR;
+    }
+    if (file_ip->type != T_FILE || off > file_ip->size)
+    {
+        Error("cmd_read: cannot read '%s' at offset %d (size %d)", name, off, file_ip->size);
+        iput(file_ip);
+        return E_ERROR;
+    }
+    len = min(len, file_ip->size - off);
+
+    uchar chunk[READ_CHUNK];
+    uint done = 0;
+    while (done < len)
+    {
+        uint n = min(READ_CHUNK, len - done);
+        if (readi(file_ip, chunk, off + done, n) != n)
+        {
+            Error("cmd_read: failed to read '%s' at offset %d", name, off + done);
+            iput(file_ip);
+            return E_ERROR;
+        }
+        if (emit(arg, chunk, n) < 0)
+        {
+            Warn("cmd_read: reading '%s' stopped after %d bytes", name, done);
+            iput(file_ip);
+            return E_ERROR;
+        }
+        done += n;
+    }
+    iput(file_ip);
+    Log("cmd_read: read %d bytes from '%s' at offset %d", done, name, off);
+    return E_SUCCESS;
+}
+
 int cmd_w(char *name, uint len, const char *data)
 {
     // FS_WRITE_LOCK();
@@ -804,11 +946,153 @@ int cmd_w(char *name, uint len, const char *data)
 
     iput(file_ip);
     Log("cmd_w: successfully wrote %d bytes to file '%s'", len, name);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
 
+// pwrite 和 append 共用: 在 off 处 (append 时在文件尾) 覆盖写入 len 字节, 不截断文件
+static int write_at(const char *cmd, char *name, int append, uint off, uint len, const char *data)
+{
+    if (name == NULL || strlen(name) == 0)
+    {
+        Error("%s: invalid filename", cmd);
+        return E_ERROR;
+    }
+    if (len > 0 && data == NULL)
+    {
+        Error("%s: invalid data pointer", cmd);
+        return E_ERROR;
+    }
+    uint file_inum = find_entry_in_directory(current_dir, name, T_FILE);
+    if (file_inum == 0)
+    {
+        Error("%s: file '%s' not found", cmd, name);
+        return E_ERROR;
+    }
+    if (!check_file_permission(file_inum, current_uid, PERM_WRITE))
+    {
+        Error("%s: no permission to write file '%s'", cmd, name);
+        return E_ERROR;
+    }
+    inode *file_ip = iget(file_inum);
+    if (file_ip == NULL)
+    {
+        Error("%s: failed to get file inode %d", cmd, file_inum);
+        return E_ERROR;
+    }
+    if (file_ip->type != T_FILE)
+    {
+        Error("%s: '%s' is not a file", cmd, name);
+        iput(file_ip);
+        return E_ERROR;
+    }
+    if (append)
+        off = file_ip->size;
+    int rc = E_SUCCESS;
+    if (len > 0)
+    {
+        // 片段表文件的追加只延长日志和最后一个片段
+        if (append)
+            rc = iinsert(file_ip, off, (uchar *)data, len) < 0 ? E_ERROR : E_SUCCESS;
+        else
+            rc = writei(file_ip, (uchar *)data, off, len) == len ? E_SUCCESS : E_ERROR;
+    }
+    uint size = file_ip->size;
+    iput(file_ip);
+    fs_commit();
+    if (rc != E_SUCCESS)
+    {
+        Error("%s: failed to write %d bytes to '%s' at offset %d", cmd, len, name, off);
+        return E_ERROR;
+    }
+    Log("%s: wrote %d bytes to '%s' at offset %d, size now %d", cmd, len, name, off, size);
+    return E_SUCCESS;
+}
+
+int cmd_pwrite(char *name, uint off, uint len, const char *data)
+{
+    return write_at("cmd_pwrite", name, 0, off, len, data);
+}
+
+int cmd_append(char *name, uint len, const char *data)
+{
+    return write_at("cmd_append", name, 1, 0, len, data);
+}
+
+// 为文件预先分配 len 字节的空间 (不改变文件大小), 之后的写入直接使用这些连续块
+int cmd_fallocate(char *name, uint len)
+{
+    if (name == NULL || strlen(name) == 0)
+    {
+        Error("cmd_fallocate: invalid filename");
+        return E_ERROR;
+    }
+    uint file_inum = find_entry_in_directory(current_dir, name, T_FILE);
+    if (file_inum == 0)
+    {
+        Error("cmd_fallocate: file '%s' not found", name);
+        return E_ERROR;
+    }
+    if (!check_file_permission(file_inum, current_uid, PERM_WRITE))
+    {
+        Error("cmd_fallocate: no permission to write file '%s'", name);
+        return E_ERROR;
+    }
+    inode *file_ip = iget(file_inum);
+    if (file_ip == NULL)
+    {
+        Error("cmd_fallocate: failed to get file inode %d", file_inum);
+        return E_ERROR;
+    }
+    int n = ifallocate(file_ip, len);
+    iput(file_ip);
+    fs_commit();
+    if (n < 0)
+    {
+        Error("cmd_fallocate: failed to allocate %d bytes for '%s'", len, name);
+        return E_ERROR;
+    }
+    Log("cmd_fallocate: allocated %d new blocks for '%s'", n, name);
+    return E_SUCCESS;
+}
+
+int cmd_pieces(char *name, int on)
+{
+    if (name == NULL || strlen(name) == 0)
+    {
+        Error("cmd_pieces: invalid filename");
+        return E_ERROR;
+    }
+    uint file_inum = find_entry_in_directory(current_dir, name, T_FILE);
+    if (file_inum == 0)
+    {
+        Error("cmd_pieces: file '%s' not found", name);
+        return E_ERROR;
+    }
+    if (!check_file_permission(file_inum, current_uid, PERM_WRITE))
+    {
+        Error("cmd_pieces: no permission to write file '%s'", name);
+        return E_ERROR;
+    }
+    inode *file_ip = iget(file_inum);
+    if (file_ip == NULL)
+    {
+        Error("cmd_pieces: failed to get file inode %d", file_inum);
+        return E_ERROR;
+    }
+    int rc = ipieces(file_ip, on);
+    iput(file_ip);
+    fs_commit();
+    if (rc < 0)
+    {
+        Error("cmd_pieces: failed to switch '%s' %s piece-table mode", name, on ? "to" : "from");
+        return E_ERROR;
+    }
+    Log("cmd_pieces: '%s' piece-table mode %s", name, on ? "on" : "off");
+    return E_SUCCESS;
+}
+
 int cmd_i(char *name, uint pos, uint len, const char *data)
 {
     // FS_WRITE_LOCK();
@@ -867,74 +1151,18 @@ int cmd_i(char *name, uint pos, uint len, const char *data)
         return E_SUCCESS;
     }
 
-    // 读取原文件内容
-    uchar *original_data = NULL;
-    uint original_size = file_ip->size;
-    if (original_size > 0)
+    // 片段表文件只在日志尾追加并改表, 其他文件把插入点之后的内容后移
+    if (iinsert(file_ip, pos, (uchar *)data, len) < 0)
     {
-        original_data = malloc(original_size);
-
-        int bytes_read = readi(file_ip, original_data, 0, original_size);
-        if (bytes_read != original_size)
-        {
-            Error("cmd_i: failed to read original file content");
-            free(original_data);
-            iput(file_ip);
-
-            return E_ERROR;
-        }
-    }
-    // 清空文件
-    file_ip->size = 0;
-    file_ip->dirty = 1;
-
-    // 写入插入位置之前的数据
-    if (pos > 0)
-    {
-        int bytes_written = writei(file_ip, original_data, 0, pos);
-        if (bytes_written != pos)
-        {
-            Error("cmd_i: failed to write pre-insert data");
-            if (original_data)
-                free(original_data);
-            iput(file_ip);
-
-            return E_ERROR;
-        }
-    }
-
-    // 写入新数据
-    int bytes_written = writei(file_ip, (uchar *)data, pos, len);
-    if (bytes_written != len)
-    {
-        Error("cmd_i: failed to write insert data");
-        if (original_data)
-            free(original_data);
+        Error("cmd_i: failed to insert data at position %d", pos);
         iput(file_ip);
 
         return E_ERROR;
     }
 
-    // 写入插入位置之后的数据
-    if (pos < original_size)
-    {
-        bytes_written = writei(file_ip, original_data + pos, pos + len, original_size - pos);
-        if (bytes_written != (original_size - pos))
-        {
-            Error("cmd_i: failed to write post-insert data");
-            if (original_data)
-                free(original_data);
-            iput(file_ip);
-
-            return E_ERROR;
-        }
-    }
-
-    if (original_data)
-        free(original_data);
     iput(file_ip);
     Log("cmd_i: successfully inserted %d bytes to file '%s' at position %d", len, name, pos);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
@@ -1000,65 +1228,18 @@ int cmd_d(char *name, uint pos, uint len)
         Log("cmd_d: adjusted delete length to %d", actual_delete_len);
     }
 
-    // 读取原文件内容
-    uint original_size = file_ip->size;
-    uchar *original_data = malloc(original_size);
-    if (original_data == NULL)
-    {
-        Error("cmd_d: failed to allocate buffer for original data");
-        iput(file_ip);
-
-        return E_ERROR;
-    }
-
-    int bytes_read = readi(file_ip, original_data, 0, original_size);
-    if (bytes_read != original_size)
+    // 片段表文件只改表, 其他文件把删除区间之后的内容前移并释放文件尾多出的块
+    if (idelete(file_ip, pos, actual_delete_len) < 0)
     {
-        Error("cmd_d: failed to read original file content");
-        free(original_data);
+        Error("cmd_d: failed to move data after position %d", pos + actual_delete_len);
         iput(file_ip);
 
         return E_ERROR;
     }
 
-    // 清空文件
-    file_ip->size = 0;
-    file_ip->dirty = 1;
-
-    // 写入删除位置之前的数据
-    if (pos > 0)
-    {
-        int bytes_written = writei(file_ip, original_data, 0, pos);
-        if (bytes_written != pos)
-        {
-            Error("cmd_d: failed to write pre-delete data");
-            free(original_data);
-            iput(file_ip);
-
-            return E_ERROR;
-        }
-    }
-
-    // 写入删除位置之后的数据
-    uint remaining_start = pos + actual_delete_len;
-    if (remaining_start < original_size)
-    {
-        uint remaining_len = original_size - remaining_start;
-        int bytes_written = writei(file_ip, original_data + remaining_start, pos, remaining_len);
-        if (bytes_written != remaining_len)
-        {
-            Error("cmd_d: failed to write post-delete data");
-            free(original_data);
-            iput(file_ip);
-
-            return E_ERROR;
-        }
-    }
-
-    free(original_data);
     iput(file_ip);
     Log("cmd_d: successfully deleted %d bytes from file '%s' at position %d", actual_delete_len, name, pos);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
@@ -1115,7 +1296,41 @@ int cmd_adduser(int uid)
         return E_ERROR;
     }
     Log("cmd_adduser: successfully created user %d", uid);
-    cache_flush();
+    fs_commit();
 
     return E_SUCCESS;
 }
+
+int cmd_allocstat(char *out, int size)
+{
+    if (!is_admin_user(current_uid))
+    {
+        Error("cmd_allocstat: only admin can view allocator statistics");
+        return E_PERMISSION_DENIED;
+    }
+    int n = alloc_format_stats(out, size);
+    if (n + 1 < size)
+    {
+        out[n++] = '\n';
+        reclaim_format_stats(out + n, size - n);
+    }
+    return E_SUCCESS;
+}
+
+int cmd_cachestat(char *out, int size)
+{
+    if (!is_admin_user(current_uid))
+    {
+        Error("cmd_cachestat: only admin can view cache statistics");
+        return E_PERMISSION_DENIED;
+    }
+    int n = cache_format_stats(out, size);
+    if (n + 1 < size)
+    {
+        out[n++] = '\n';
+        n += icache_format_stats(out + n, size - n);
+    }
+    if (n + 1 < size)
+        snprintf(out + n, size - n, "\nzero-fill writes avoided %ld", block_zero_writes_saved());
+    return E_SUCCESS;
+}
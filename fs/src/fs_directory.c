@@ -29,28 +29,41 @@ uint find_entry_in_directory(uint dir_inum, char *name, short entry_type)
 
     uint found_inum = 0;
 
-    // 遍历目录的所有地址块
-    for (int addr_index = 0; addr_index < NDIRECT + 2 && found_inum == 0; addr_index++)
+    // extent 目录按逻辑块遍历
+    if (dir_ip->flags & IF_EXTENTS)
     {
-        if (addr_index < NDIRECT) // 直接块
+        uint nblocks = (dir_ip->size + BSIZE - 1) / BSIZE;
+        for (uint bn = 0; bn < nblocks && found_inum == 0; bn++)
         {
-            if (dir_ip->addrs[addr_index] != 0)
-            {
-                found_inum = search_directory_block(dir_ip->addrs[addr_index], name, entry_type, NULL, 0, NULL);
-            }
+            uint addr = bmap_lookup(dir_ip, bn);
+            if (addr != 0)
+                found_inum = search_directory_block(addr, name, entry_type, NULL, 0, NULL);
         }
-        else if (addr_index == NDIRECT) // 一级间接块
+    }
+    else // 遍历目录的所有地址块
+    {
+        for (int addr_index = 0; addr_index < NDIRECT + 2 && found_inum == 0; addr_index++)
         {
-            if (dir_ip->addrs[NDIRECT] != 0)
+            if (addr_index < NDIRECT) // 直接块
             {
-                found_inum = search_indirect_block(dir_ip->addrs[NDIRECT], name, entry_type, NULL, 0, NULL);
+                if (dir_ip->addrs[addr_index] != 0)
+                {
+                    found_inum = search_directory_block(dir_ip->addrs[addr_index], name, entry_type, NULL, 0, NULL);
+                }
             }
-        }
-        else // 二级间接块
-        {
-            if (dir_ip->addrs[NDIRECT + 1] != 0)
+            else if (addr_index == NDIRECT) // 一级间接块
+            {
+                if (dir_ip->addrs[NDIRECT] != 0)
+                {
+                    found_inum = search_indirect_block(dir_ip->addrs[NDIRECT], name, entry_type, NULL, 0, NULL);
+                }
+            }
+            else // 二级间接块
             {
-                found_inum = search_double_indirect_block(dir_ip->addrs[NDIRECT + 1], name, entry_type, NULL, 0, NULL);
+                if (dir_ip->addrs[NDIRECT + 1] != 0)
+                {
+                    found_inum = search_double_indirect_block(dir_ip->addrs[NDIRECT + 1], name, entry_type, NULL, 0, NULL);
+                }
             }
         }
     }
@@ -88,28 +101,41 @@ int collect_directory_entries(uint dir_inum, entry *entries_array, uint max_entr
     Log("collect_directory_entries: collecting entries from directory %d", dir_inum);
 
     *count = 0;
-    // 遍历目录的所有地址块
-    for (int addr_index = 0; addr_index < NDIRECT + 2 && *count < max_entries; addr_index++)
+    // extent 目录按逻辑块遍历
+    if (dir_ip->flags & IF_EXTENTS)
     {
-        if (addr_index < NDIRECT) // 直接块
+        uint nblocks = (dir_ip->size + BSIZE - 1) / BSIZE;
+        for (uint bn = 0; bn < nblocks && *count < max_entries; bn++)
         {
-            if (dir_ip->addrs[addr_index] != 0)
-            {
-                search_directory_block(dir_ip->addrs[addr_index], NULL, -1, entries_array, max_entries, count);
-            }
+            uint addr = bmap_lookup(dir_ip, bn);
+            if (addr != 0)
+                search_directory_block(addr, NULL, -1, entries_array, max_entries, count);
         }
-        else if (addr_index == NDIRECT) // 一级间接块
+    }
+    else // 遍历目录的所有地址块
+    {
+        for (int addr_index = 0; addr_index < NDIRECT + 2 && *count < max_entries; addr_index++)
         {
-            if (dir_ip->addrs[NDIRECT] != 0)
+            if (addr_index < NDIRECT) // 直接块
             {
-                search_indirect_block(dir_ip->addrs[NDIRECT], NULL, -1, entries_array, max_entries, count);
+                if (dir_ip->addrs[addr_index] != 0)
+                {
+                    search_directory_block(dir_ip->addrs[addr_index], NULL, -1, entries_array, max_entries, count);
+                }
             }
-        }
-        else // 二级间接块
-        {
-            if (dir_ip->addrs[NDIRECT + 1] != 0)
+            else if (addr_index == NDIRECT) // 一级间接块
+            {
+                if (dir_ip->addrs[NDIRECT] != 0)
+                {
+                    search_indirect_block(dir_ip->addrs[NDIRECT], NULL, -1, entries_array, max_entries, count);
+                }
+            }
+            else // 二级间接块
             {
-                search_double_indirect_block(dir_ip->addrs[NDIRECT + 1], NULL, -1, entries_array, max_entries, count);
+                if (dir_ip->addrs[NDIRECT + 1] != 0)
+                {
+                    search_double_indirect_block(dir_ip->addrs[NDIRECT + 1], NULL, -1, entries_array, max_entries, count);
+                }
             }
         }
     }
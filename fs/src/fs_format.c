@@ -6,8 +6,61 @@
 #include "bitmap.h"
 #include "user.h"
 
-// 初始化超级块
-void init_sb(int size)
+// 把内存中的超级块写入块 0 (格式化以及孤儿表变化时)
+void write_sb(void)
+{
+    uchar buf[BSIZE];
+    memset(buf, 0, BSIZE);
+    memcpy(buf, &sb, sizeof(sb));
+    write_block(0, buf);
+    Log("write_sb: superblock written (%d orphans)", sb.norphan);
+}
+
+// 按柱面组划分磁盘: 每组 BPB 块 (正好由一个位图块覆盖), 各组有自己的块位图、inode 位图和 inode 表
+// 末尾不足一组的块数据区太小时不使用; 位图和 inode 表以外的字段沿用原含义, 其中位图块数为组数
+static void init_sb_cgroups(int size, uint features)
+{
+    uint ipb = BSIZE / sizeof(dinode);
+    uint ncg = size / BPB;
+    uint rem = size % BPB;
+    uint ninodes = size / RATE;
+    uint ipg = ((ninodes / (ncg + 1) + ipb - 1) / ipb) * ipb; // 先按可能的最大组数估计每组的 inode 数
+    if (ncg == 0 || rem >= 2 + ipg / ipb + CG_MIN_BLOCKS)
+        ncg++;
+    else
+        size = ncg * BPB;
+    ipg = (((ninodes + ncg - 1) / ncg + ipb - 1) / ipb) * ipb;
+    if (ipg == 0)
+        ipg = ipb;
+    if (ipg > BPB)
+        ipg = BPB; // 一个 inode 位图块最多覆盖 BPB 个 inode
+
+    memset(&sb, 0, sizeof(sb));
+    sb.magic = MAGIC;
+    sb.size = size;
+    sb.features = features;
+    sb.ncg = ncg;
+    sb.cgblocks = BPB;
+    sb.ipg = ipg;
+    sb.cgiblocks = ipg / ipb;
+    sb.bmapstart = cg_bmap_block(0);
+    sb.bmapblocks = ncg;
+    sb.inodebmapstart = cg_ibmap_block(0);
+    sb.inodebmapblocks = ncg;
+    sb.inodestart = cg_inode_start(0);
+    sb.ninodes = ncg * ipg;
+    sb.logstart = sb.inodestart + sb.cgiblocks;
+    sb.nlog = LOGS;
+    sb.datastart = sb.logstart + sb.nlog;
+    sb.ndatablocks = 0;
+    for (uint g = 0; g < ncg; g++)
+        sb.ndatablocks += cg_end(g) - cg_data_start(g);
+    write_sb();
+    Log("init_sb: %d cylinder groups of %d blocks, %d inodes per group", ncg, BPB, ipg);
+}
+
+// 初始化超级块, features 为新建 inode 采用的特性 (FEAT_*)
+void init_sb(int size, uint features)
 {
     if (size <= 0 || size > MAXBLOCK)
     {
@@ -15,6 +68,12 @@ void init_sb(int size)
         return;
     }
 
+    if (features & FEAT_CGROUPS)
+    {
+        init_sb_cgroups(size, features);
+        return;
+    }
+
     uint bmapstart = 1;                           // 位图从第1块开始（第0块是超级块）
     uint bmapblocks = size / BPB + 1;             // 数据块位图块数
     uint inodebmapstart = bmapstart + bmapblocks; // inode位图从数据块位图之后开始
@@ -22,8 +81,9 @@ void init_sb(int size)
     uint ninodes = size / RATE;               // inode数量约为总块数的1/RATE
     uint inodebmapblocks = ninodes / BPB + 1; // inode位图块数
     uint inodestart = inodebmapstart + inodebmapblocks;
+    uint inodeblocks = (ninodes + BSIZE / sizeof(dinode) - 1) / (BSIZE / sizeof(dinode)); // inode表块数
 
-    uint logstart = inodestart + inodebmapblocks; // 日志从inode位图之后开始
+    uint logstart = inodestart + inodeblocks; // 日志从inode表之后开始
     uint nlog = LOGS;                             // 日志块数量
     uint datastart = logstart + nlog;             // 数据块从日志之后开始
     uint ndatablocks = size - datastart;
@@ -42,12 +102,8 @@ void init_sb(int size)
     sb.nlog = nlog;
     sb.datastart = datastart;
     sb.ndatablocks = ndatablocks;
-
-    uchar buf[BSIZE];
-    memset(buf, 0, BSIZE);
-    memcpy(buf, &sb, sizeof(sb));
-    write_block(0, buf);
-    Log("Superblock initialized successfully");
+    sb.features = features;
+    write_sb();
 }
 
 // 初始化目录内容（创建 "." 和 ".." 条目）
@@ -77,7 +133,7 @@ int init_directory_entries(uint dir_inum, uint parent_inum, uint data_block, sho
     uchar buf[BSIZE];
     memset(buf, 0, BSIZE);
     memcpy(buf, dir_entries, 2 * sizeof(entry));
-    write_block(data_block, buf);
+    write_block_as(data_block, buf, BC_DIR);
 
     Log("init_directory_entries: initialized directory %d with parent %d", dir_inum, parent_inum);
     return 0;
@@ -101,18 +157,16 @@ void init_root_directory()
     root_ip->nlink = 2;         // 根目录至少有两个链接（"." 和 ".."）
     root_ip->uid = current_uid; // 设置为当前用户 ID
     root_ip->size = 2 * sizeof(entry);
-    root_ip->blocks = 1; // 根目录至少有一个数据块
-    root_ip->dirty = 1;  // 标记为脏，需要写回磁盘
+    root_ip->dirty = 1; // 标记为脏，需要写回磁盘
 
-    // 为根目录分配数据块 - 通过 allocate_block
-    uint root_data_block = allocate_block();
+    // 为根目录分配数据块 - 通过 bmap, 同时维护块计数和映射
+    uint root_data_block = bmap(root_ip, 0);
     if (root_data_block == 0)
     {
         Error("init_root_directory: failed to allocate data block");
         iput(root_ip);
         return;
     }
-    root_ip->addrs[0] = root_data_block;
 
     iupdate(root_ip);
 
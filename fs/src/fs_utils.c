@@ -10,7 +10,7 @@
 uint search_directory_block(uint block_addr, char *name, short entry_type, entry *entries_array, uint max_entries, uint *current_count)
 {
     uchar buf[BSIZE];
-    read_block(block_addr, buf);
+    read_block_as(block_addr, buf, BC_DIR);
 
     uint offset = 0;
     while (offset + sizeof(entry) <= BSIZE)
@@ -52,7 +52,7 @@ uint search_indirect_block(uint indirect_addr, char *name, short entry_type, ent
     }
 
     uchar buf[BSIZE];
-    read_block(indirect_addr, buf);
+    read_block_as(indirect_addr, buf, BC_INDIRECT);
     uint *block_addrs = (uint *)buf;
 
     for (int i = 0; i < APB; i++)
@@ -86,7 +86,7 @@ uint search_double_indirect_block(uint double_indirect_addr, char *name, short e
     }
 
     uchar buf[BSIZE];
-    read_block(double_indirect_addr, buf);
+    read_block_as(double_indirect_addr, buf, BC_INDIRECT);
     uint *level1_addrs = (uint *)buf;
     for (int i = 0; i < APB; i++)
     {
@@ -1,5 +1,6 @@
 #include "inode.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -8,6 +9,114 @@
 #include "log.h"
 #include "bitmap.h"
 
+static inode *ialloc_at(short type, int inum);
+static void prealloc_drop(inode *ip);
+typedef struct da_block da_block;
+static da_block *da_find(inode *ip, uint lblk);
+static void da_release(inode *ip, int drop);
+static void da_reset(void);
+static void da_flush_inode(inode *ip);
+static int piece_read(inode *ip, uchar *dst, uint off, uint n);
+static int piece_write(inode *ip, uchar *src, uint off, uint n);
+static void pt_free(inode *ip);
+
+// inode 所在的磁盘块: 使用柱面组时 inode 表按组分段, 组 g 存放 [g * ipg, (g + 1) * ipg) 号 inode
+static uint inode_block(uint inum)
+{
+    uint ipb = BSIZE / sizeof(dinode);
+    if (cg_count() > 0)
+        return cg_inode_start(inum / sb.ipg) + (inum % sb.ipg) / ipb;
+    return sb.inodestart + inum / ipb;
+}
+
+// inode 所在的柱面组
+static uint inode_group(uint inum)
+{
+    return cg_count() > 0 ? inum / sb.ipg : 0;
+}
+
+// 文件第一个数据块的目标位置: inode 所在柱面组的数据区开头 (0 表示由分配器决定)
+static uint inode_goal(inode *ip)
+{
+    return cg_count() > 0 ? cg_data_start(inode_group(ip->inum)) : 0;
+}
+
+// 为块映射的 inode 分配一个数据块: 使用柱面组时放在 inode 所在的组
+static uint alloc_data_block(inode *ip)
+{
+    return cg_count() > 0 ? allocate_block_near(inode_goal(ip)) : allocate_block_uninit();
+}
+
+// 返回映射块 (间接块或溢出 extent 块) 的解码副本; 命中 inode 自带的映射缓存时不访问块缓存
+// 修改副本后由调用者用 write_block_as 写回, 副本与块内容保持一致
+static uint *imap_get(inode *ip, uint blockno)
+{
+    imap_entry *victim = &ip->imap[0];
+    for (int i = 0; i < IMAP_SLOTS; i++)
+    {
+        imap_entry *e = &ip->imap[i];
+        if (e->blockno == blockno)
+        {
+            e->used = ++ip->imap_tick;
+            return e->addrs;
+        }
+        if (e->used < victim->used)
+            victim = e;
+    }
+    read_block_as(blockno, (uchar *)victim->addrs, BC_INDIRECT);
+    victim->blockno = blockno;
+    victim->used = ++ip->imap_tick;
+    return victim->addrs;
+}
+
+// 映射被截断或 inode 槽位换主时丢弃映射缓存和顺序读状态
+static void imap_invalidate(inode *ip)
+{
+    memset(ip->imap, 0, sizeof(ip->imap));
+    ip->imap_tick = 0;
+    memset(&ip->seq, 0, sizeof(ip->seq));
+}
+
+// inode 缓存: 按 inum 缓存内存 inode, 引用计数归零后仍保留, 需要槽位时复用最久未用的一项
+static inode icache[ICACHE_SIZE];
+static pthread_mutex_t icache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t itable_lock = PTHREAD_MUTEX_INITIALIZER; // inode 表块的读改写 (后台回收线程也会更新 inode)
+static pthread_once_t icache_once = PTHREAD_ONCE_INIT;
+static unsigned long icache_tick = 0;
+static long icache_hits = 0, icache_misses = 0;
+
+static void icache_init(void)
+{
+    da_reset();
+}
+
+// 查找 inum 的缓存项, 没有时取一个空闲槽位; 调用者持有 icache_lock
+static inode *icache_slot(uint inum, int *hit)
+{
+    inode *victim = NULL;
+    *hit = 0;
+    for (int i = 0; i < ICACHE_SIZE; i++)
+    {
+        inode *ip = &icache[i];
+        if (ip->valid && ip->inum == inum)
+        {
+            *hit = 1;
+            return ip;
+        }
+        if (ip->ref > 0)
+            continue;
+        if (victim == NULL || (victim->valid && (!ip->valid || ip->lru < victim->lru)))
+            victim = ip;
+    }
+    if (victim != NULL && victim->valid)
+        da_flush_inode(victim); // 延迟块在 inode 离开缓存前分配并写入
+    if (victim != NULL && victim->valid && victim->dirty)
+        iupdate(victim); // 被替换前写回
+    if (victim != NULL && victim->valid)
+        prealloc_drop(victim);
+    return victim;
+}
+
 // 获取指定inode的内存表示
 inode *iget(uint inum)
 {
@@ -16,8 +125,35 @@ inode *iget(uint inum)
         Error("iget: inum out of range");
         return NULL;
     }
+    pthread_once(&icache_once, icache_init);
+    pthread_mutex_lock(&icache_lock);
+
+    int hit;
+    inode *ip = icache_slot(inum, &hit);
+    if (ip == NULL)
+    {
+        pthread_mutex_unlock(&icache_lock);
+        Error("iget: inode cache full");
+        return NULL;
+    }
+    if (hit)
+    {
+        if (ip->type == T_UNUSED)
+        {
+            pthread_mutex_unlock(&icache_lock);
+            Error("iget: inode %d is unused", inum);
+            return NULL;
+        }
+        ip->ref++;
+        icache_hits++;
+        pthread_mutex_unlock(&icache_lock);
+        return ip;
+    }
+    icache_misses++;
+    ip->valid = 0;
+
     // 计算包含该inode的磁盘块号
-    uint block_num = sb.inodestart + inum / (BSIZE / sizeof(dinode));
+    uint block_num = inode_block(inum);
     uint offset = inum % (BSIZE / sizeof(dinode));
 
     // 读取包含该inode的磁盘块
@@ -30,17 +166,11 @@ inode *iget(uint inum)
     // 检查inode是否有效
     if (disk_inode->type == T_UNUSED)
     {
+        pthread_mutex_unlock(&icache_lock);
         Error("iget: inode %d is unused", inum);
         return NULL;
     }
 
-    inode *ip = (inode *)malloc(sizeof(inode));
-    if (ip == NULL)
-    {
-        Error("iget: malloc failed");
-        return NULL;
-    }
-
     // 将dinode的内容复制到内存inode中
     ip->inum = inum;
     ip->type = disk_inode->type;
@@ -48,23 +178,76 @@ inode *iget(uint inum)
     ip->nlink = disk_inode->nlink;
     ip->uid = disk_inode->uid;
     ip->size = disk_inode->size;
-    ip->dirty = disk_inode->dirty;
+    ip->dirty = 0;
     ip->blocks = disk_inode->blocks;
+    ip->flags = disk_inode->flags;
 
     // 复制地址数组
     for (int i = 0; i < NDIRECT + 2; i++)
     {
         ip->addrs[i] = disk_inode->addrs[i];
     }
+    imap_invalidate(ip);
+    ip->valid = 1;
+    ip->ref = 1;
+    pthread_mutex_unlock(&icache_lock);
 
     Log("iget: loaded inode %d (type=%d, size=%d)", inum, ip->type, ip->size);
     return ip;
 }
 
+// 释放 extent inode 的数据块和溢出 extent 块
+static uint free_extent_blocks(inode *ip)
+{
+    uint block_count = 0;
+    extent *ext = (extent *)ip->addrs;
+    for (uint i = 0; i < ip->addrs[EXT_COUNT]; i++)
+    {
+        for (uint j = 0; j < ext[i].len; j++)
+            free_block(ext[i].pblk + j);
+        block_count += ext[i].len;
+    }
+    uint next = ip->addrs[EXT_OVERFLOW];
+    while (next != 0)
+    {
+        extent_block eb;
+        read_block_as(next, (uchar *)&eb, BC_INDIRECT);
+        for (uint i = 0; i < eb.count; i++)
+        {
+            for (uint j = 0; j < eb.e[i].len; j++)
+                free_block(eb.e[i].pblk + j);
+            block_count += eb.e[i].len;
+        }
+        free_block(next);
+        block_count++; // 溢出块本身
+        next = eb.next;
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    return block_count;
+}
+
 // 释放inode的所有数据块
 void free_inode_blocks(inode *ip)
 {
     uint block_count = 0; // 记录释放的块数
+    imap_invalidate(ip);
+    prealloc_drop(ip);
+    da_release(ip, 1); // 还没有写回的数据直接丢弃, 不占用位图也不写盘
+    if (ip->flags & IF_PIECES)
+        pt_free(ip);
+    if (ip->flags & (IF_INLINE | IF_EXTENTS))
+    {
+        if (ip->flags & IF_INLINE)
+            memset(ip->addrs, 0, sizeof(ip->addrs));
+        else
+            block_count = free_extent_blocks(ip);
+        if (ip->type == T_FILE && (sb.features & FEAT_INLINE_DATA))
+            ip->flags |= IF_INLINE; // 清空后的文件重新内联
+        ip->size = 0;
+        ip->blocks = 0;
+        Log("free_inode_blocks: freed %d blocks from inode %d", block_count, ip->inum);
+        return;
+    }
     // 释放直接块
     for (int i = 0; i < NDIRECT; i++)
     {
@@ -79,7 +262,7 @@ void free_inode_blocks(inode *ip)
     if (ip->addrs[NDIRECT] != 0)
     {
         uchar buf[BSIZE];
-        read_block(ip->addrs[NDIRECT], buf);
+        read_block_as(ip->addrs[NDIRECT], buf, BC_INDIRECT);
         uint *addrs = (uint *)buf;
 
         for (int i = 0; i < APB; i++)
@@ -98,7 +281,7 @@ void free_inode_blocks(inode *ip)
     if (ip->addrs[NDIRECT + 1] != 0)
     {
         uchar buf[BSIZE];
-        read_block(ip->addrs[NDIRECT + 1], buf);
+        read_block_as(ip->addrs[NDIRECT + 1], buf, BC_INDIRECT);
         uint *level1_addrs = (uint *)buf;
 
         for (int i = 0; i < APB; i++)
@@ -106,7 +289,7 @@ void free_inode_blocks(inode *ip)
             if (level1_addrs[i] != 0)
             {
                 uchar buf2[BSIZE];
-                read_block(level1_addrs[i], buf2);
+                read_block_as(level1_addrs[i], buf2, BC_INDIRECT);
                 uint *level2_addrs = (uint *)buf2;
 
                 for (int j = 0; j < APB; j++)
@@ -122,6 +305,7 @@ void free_inode_blocks(inode *ip)
             }
         }
         free_block(ip->addrs[NDIRECT + 1]);
+        ip->addrs[NDIRECT + 1] = 0;
         block_count++; // 二级间接块本身
     }
 
@@ -142,10 +326,11 @@ void free_inode_in_bitmap(uint inum)
 // 清零磁盘上的inode
 void clear_disk_inode(uint inum)
 {
-    uint block_num = sb.inodestart + inum / (BSIZE / sizeof(dinode));
+    uint block_num = inode_block(inum);
     uint offset = inum % (BSIZE / sizeof(dinode));
 
     uchar buf[BSIZE];
+    pthread_mutex_lock(&itable_lock);
     read_block(block_num, buf);
 
     dinode *disk_inode = (dinode *)buf + offset;
@@ -153,15 +338,17 @@ void clear_disk_inode(uint inum)
     disk_inode->type = T_UNUSED;
 
     write_block(block_num, buf);
+    pthread_mutex_unlock(&itable_lock);
 }
 
-// 释放inode并将其写回磁盘
+// 释放一个引用; 最后一个引用释放时, 没有链接的 inode 连同数据块一起释放
 void iput(inode *ip)
 {
     if (ip == NULL)
     {
         return;
     }
+    pthread_mutex_lock(&icache_lock);
 
     // 如果inode被修改过，写回磁盘
     if (ip->dirty)
@@ -170,18 +357,246 @@ void iput(inode *ip)
     }
 
     // 检查是否需要释放inode和相关资源
-    if (ip->nlink == 0)
+    if (ip->ref == 1 && ip->nlink == 0 && (ip->flags & IF_ORPHAN))
+    {
+        // 孤儿 inode 的块由后台回收线程释放, 这里只丢弃内存中还没有分配的块
+        prealloc_drop(ip);
+        da_release(ip, 1);
+    }
+    else if (ip->ref == 1 && ip->nlink == 0)
     {
         free_inode_blocks(ip);          // 释放文件的所有数据块
         free_inode_in_bitmap(ip->inum); // 在inode位图中标记该inode为空闲
         clear_disk_inode(ip->inum);     // 清零磁盘上的inode
+        ip->valid = 0;
+    }
+    else if (ip->ref == 1 && ip->type == T_UNUSED)
+    {
+        prealloc_drop(ip);
+        da_release(ip, 1);
+        ip->valid = 0; // 已被删除的 inode 不再缓存
     }
-    // 释放内存
     uint inum = ip->inum;
-    free(ip);
+    if (ip->ref > 0)
+        ip->ref--;
+    ip->lru = ++icache_tick;
+    pthread_mutex_unlock(&icache_lock);
     Log("iput: inode %d released", inum);
 }
 
+// 格式化后 inode 表已重建, 丢弃所有缓存的 inode
+void icache_invalidate(void)
+{
+    pthread_once(&icache_once, icache_init);
+    pthread_mutex_lock(&icache_lock);
+    for (int i = 0; i < ICACHE_SIZE; i++)
+    {
+        if (icache[i].ref > 0)
+            Warn("icache_invalidate: inode %d still referenced", icache[i].inum);
+        icache[i].valid = 0;
+        icache[i].ref = 0;
+        icache[i].dirty = 0;
+        icache[i].pa_len = 0; // 空闲区间随新位图重建, 旧的预留自然作废
+        icache[i].da_count = 0;
+    }
+    da_reset();
+    pthread_mutex_unlock(&icache_lock);
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+// 归还 inode 的预留窗口中没有用到的块
+static void prealloc_drop(inode *ip)
+{
+    if (ip->pa_len == 0)
+        return;
+    release_reserved(ip->pa_start, ip->pa_len, ip->pa_gen);
+    ip->pa_len = 0;
+}
+
+// 归还没有被引用、且超过 PREALLOC_IDLE_MS 没有写入的 inode 的预留窗口
+void prealloc_release_idle(void)
+{
+    pthread_once(&icache_once, icache_init);
+    long now = now_ms();
+    pthread_mutex_lock(&icache_lock);
+    for (int i = 0; i < ICACHE_SIZE; i++)
+    {
+        inode *ip = &icache[i];
+        if (ip->valid && ip->ref == 0 && ip->pa_len > 0 && now - ip->pa_used >= PREALLOC_IDLE_MS)
+            prealloc_drop(ip);
+    }
+    pthread_mutex_unlock(&icache_lock);
+}
+
+// 延迟分配池: 写入文件空洞的数据先按 (inode, 逻辑块) 放在这里, 写回时才分配物理块
+// 同一 inode 的块用 next 串成链表; da_lock 只保护空闲链表和统计, 链表本身由持有 inode 的一方修改
+struct da_block
+{
+    int next;          // 同一 inode 的下一块, 或空闲链表的下一项, -1 表示没有
+    uint lblk;         // 逻辑块号
+    uchar data[BSIZE]; // 块内容
+};
+
+static da_block da_pool[DELALLOC_MAX_BLOCKS];
+static int da_free_list = -1;
+static int da_pending = 0; // 池中尚未写回的块数
+static int da_enabled = 0;
+static long da_flushed = 0, da_runs = 0, da_dropped = 0;
+static pthread_mutex_t da_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 清空延迟分配池 (初始化和格式化时, 调用者保证没有并发)
+static void da_reset(void)
+{
+    pthread_mutex_lock(&da_lock);
+    for (int i = 0; i < DELALLOC_MAX_BLOCKS; i++)
+        da_pool[i].next = i + 1 < DELALLOC_MAX_BLOCKS ? i + 1 : -1;
+    da_free_list = 0;
+    da_pending = 0;
+    pthread_mutex_unlock(&da_lock);
+}
+
+void delalloc_set(int on)
+{
+    if (!on)
+        delalloc_flush(1);
+    da_enabled = on;
+    Log("delalloc: delayed allocation %s", on ? "enabled" : "disabled");
+}
+
+static da_block *da_find(inode *ip, uint lblk)
+{
+    if (ip->da_count == 0)
+        return NULL;
+    for (int i = ip->da_head; i >= 0; i = da_pool[i].next)
+    {
+        if (da_pool[i].lblk == lblk)
+            return &da_pool[i];
+    }
+    return NULL;
+}
+
+// 把 inode 的延迟块全部放回空闲链表; drop 表示数据被丢弃 (文件删除或截断)
+static void da_release(inode *ip, int drop)
+{
+    if (ip->da_count == 0)
+        return;
+    pthread_mutex_lock(&da_lock);
+    for (int i = ip->da_head; i >= 0;)
+    {
+        int next = da_pool[i].next;
+        da_pool[i].next = da_free_list;
+        da_free_list = i;
+        i = next;
+    }
+    da_pending -= ip->da_count;
+    if (drop)
+        da_dropped += ip->da_count;
+    pthread_mutex_unlock(&da_lock);
+    if (drop)
+        Log("delalloc: dropped %d delayed blocks of inode %d", ip->da_count, ip->inum);
+    ip->da_count = 0;
+}
+
+// 丢弃逻辑块 keep 及之后的延迟块
+static void da_truncate(inode *ip, uint keep)
+{
+    if (ip->da_count == 0)
+        return;
+    uint dropped = 0;
+    pthread_mutex_lock(&da_lock);
+    int *link = &ip->da_head;
+    for (int i = ip->da_head; i >= 0;)
+    {
+        int next = da_pool[i].next;
+        if (da_pool[i].lblk >= keep)
+        {
+            *link = next;
+            da_pool[i].next = da_free_list;
+            da_free_list = i;
+            dropped++;
+        }
+        else
+        {
+            link = &da_pool[i].next;
+        }
+        i = next;
+    }
+    da_pending -= dropped;
+    da_dropped += dropped;
+    pthread_mutex_unlock(&da_lock);
+    ip->da_count -= dropped;
+}
+
+static int da_pop(void)
+{
+    pthread_mutex_lock(&da_lock);
+    int i = da_free_list;
+    if (i >= 0)
+    {
+        da_free_list = da_pool[i].next;
+        da_pending++;
+    }
+    pthread_mutex_unlock(&da_lock);
+    return i;
+}
+
+// 池满时写回除 ip 以外所有 inode 的延迟块 (ip 正在写入, 文件大小还没有更新)
+static void da_flush_others(inode *ip)
+{
+    pthread_mutex_lock(&icache_lock);
+    for (int i = 0; i < ICACHE_SIZE; i++)
+    {
+        if (&icache[i] != ip && icache[i].valid)
+            da_flush_inode(&icache[i]);
+    }
+    pthread_mutex_unlock(&icache_lock);
+}
+
+// 为逻辑块 lblk 新建一个内容全零的延迟块, 池中没有空位时返回 NULL (调用者改为立即分配)
+static da_block *da_get(inode *ip, uint lblk)
+{
+    int i = da_pop();
+    if (i < 0)
+    {
+        da_flush_others(ip);
+        i = da_pop();
+        if (i < 0)
+            return NULL;
+    }
+    da_block *e = &da_pool[i];
+    e->lblk = lblk;
+    memset(e->data, 0, BSIZE);
+    e->next = ip->da_count > 0 ? ip->da_head : -1;
+    if (ip->da_count == 0)
+        ip->da_since = now_ms();
+    ip->da_head = i;
+    ip->da_count++;
+    return e;
+}
+
+// 输出 inode 缓存命中统计, 返回写入的字节数
+int icache_format_stats(char *out, int size)
+{
+    pthread_mutex_lock(&icache_lock);
+    int used = 0;
+    for (int i = 0; i < ICACHE_SIZE; i++)
+        used += icache[i].valid;
+    int n = snprintf(out, size, "icache %d/%d hits %ld misses %ld", used, ICACHE_SIZE, icache_hits, icache_misses);
+    pthread_mutex_lock(&da_lock);
+    if (n < size)
+        n += snprintf(out + n, size - n, "\ndelalloc %s, %d blocks pending, %ld written in %ld runs, %ld dropped",
+                      da_enabled ? "on" : "off", da_pending, da_flushed, da_runs, da_dropped);
+    pthread_mutex_unlock(&da_lock);
+    pthread_mutex_unlock(&icache_lock);
+    return n < size ? n : size - 1;
+}
+
 // 初始化一个新的inode
 void init_inode(inode *ip, uint inum, short type)
 {
@@ -191,8 +606,10 @@ void init_inode(inode *ip, uint inum, short type)
         return;
     }
 
-    // 清零整个结构
-    memset(ip, 0, sizeof(inode));
+    // 清零持久化字段 (引用计数和锁由 inode 缓存管理)
+    ip->nlink = 0;
+    ip->flags = 0;
+    memset(ip->addrs, 0, sizeof(ip->addrs));
 
     // 设置基本信息
     ip->inum = inum;
@@ -201,6 +618,9 @@ void init_inode(inode *ip, uint inum, short type)
     ip->size = 0;
     ip->dirty = 1;  // 标记为脏，需要写回磁盘
     ip->blocks = 0; // 初始化块计数为0
+    ip->flags = (sb.features & FEAT_EXTENTS) ? IF_EXTENTS : 0; // 按格式化时选择的映射方式
+    if (type == T_FILE && (sb.features & FEAT_INLINE_DATA))
+        ip->flags |= IF_INLINE; // 小文件先内联在 inode 中
 
     switch (type)
     {
@@ -236,6 +656,28 @@ int mark_inode_used(uint inum)
     return inode_bitmap_set_used(inum);
 }
 
+// 为新 inode 选择柱面组 (FFS 策略): 目录分散到空闲块最多且还有空闲 inode 的组,
+// 文件放在父目录所在的组, 使目录和其中的文件在磁盘上靠在一起
+static uint pick_group(short type, uint parent)
+{
+    uint best = inode_group(parent);
+    if (type != T_DIR)
+        return best;
+    int best_free = -1;
+    for (uint g = 0; g < cg_count(); g++)
+    {
+        if (bitmap_region_free(BITMAP_INODE, g) <= 0)
+            continue;
+        int nfree = bitmap_region_free(BITMAP_BLOCK, g);
+        if (nfree > best_free)
+        {
+            best = g;
+            best_free = nfree;
+        }
+    }
+    return best;
+}
+
 // 分配一个新的inode
 inode *ialloc(short type)
 {
@@ -245,17 +687,55 @@ inode *ialloc(short type)
         Error("ialloc: no free inodes available");
         return NULL;
     }
+    return ialloc_at(type, inum);
+}
+
+// 在父目录 parent 之下分配新的 inode, 使用柱面组时按 pick_group 选择所在的组 (组满时顺延到后面的组)
+inode *ialloc_in(short type, uint parent)
+{
+    if (cg_count() == 0)
+        return ialloc(type);
+    uint g = pick_group(type, parent);
+    int inum = bitmap_find_free_from(BITMAP_INODE, g * sb.ipg);
+    if (inum == -1)
+    {
+        Error("ialloc: no free inodes available");
+        return NULL;
+    }
+    Log("ialloc: placing %s in cylinder group %d (parent %d)", type == T_DIR ? "directory" : "file", inode_group(inum),
+        parent);
+    return ialloc_at(type, inum);
+}
 
+// 把 inum 号 inode 标记为已用并初始化
+static inode *ialloc_at(short type, int inum)
+{
     if (mark_inode_used(inum) < 0)
     {
         Error("ialloc: failed to mark inode %d as used", inum);
         return NULL;
     }
 
-    clear_disk_inode(inum);                     // 清零磁盘上的inode
-    inode *ip = (inode *)malloc(sizeof(inode)); // 分配内存inode
-    init_inode(ip, inum, type);                 // 初始化内存inode
-    iupdate(ip);                                // 写回磁盘
+    clear_disk_inode(inum); // 清零磁盘上的inode
+
+    // 在 inode 缓存中取一个槽位
+    pthread_once(&icache_once, icache_init);
+    pthread_mutex_lock(&icache_lock);
+    int hit;
+    inode *ip = icache_slot(inum, &hit);
+    if (ip == NULL)
+    {
+        pthread_mutex_unlock(&icache_lock);
+        Error("ialloc: inode cache full");
+        free_inode_in_bitmap(inum);
+        return NULL;
+    }
+    init_inode(ip, inum, type); // 初始化内存inode
+    imap_invalidate(ip);
+    ip->valid = 1;
+    ip->ref = 1;
+    iupdate(ip); // 写回磁盘
+    pthread_mutex_unlock(&icache_lock);
 
     Log("ialloc: successfully allocated inode %d (type=%d)", inum, type);
     return ip;
@@ -271,11 +751,12 @@ void iupdate(inode *ip)
     }
 
     // 计算包含该inode的磁盘块号
-    uint block_num = sb.inodestart + ip->inum / (BSIZE / sizeof(dinode));
+    uint block_num = inode_block(ip->inum);
     uint offset = ip->inum % (BSIZE / sizeof(dinode));
 
     // 读取磁盘块
     uchar buf[BSIZE];
+    pthread_mutex_lock(&itable_lock);
     read_block(block_num, buf);
 
     // 定位到具体的dinode
@@ -287,8 +768,9 @@ void iupdate(inode *ip)
     disk_inode->nlink = ip->nlink;
     disk_inode->uid = ip->uid;
     disk_inode->size = ip->size;
-    disk_inode->dirty = ip->dirty = 0; // 清除脏标志
+    disk_inode->flags = ip->flags;
     disk_inode->blocks = ip->blocks;
+    ip->dirty = 0; // 清除脏标志
 
     // 复制地址数组
     for (int i = 0; i < NDIRECT + 2; i++)
@@ -298,236 +780,1502 @@ void iupdate(inode *ip)
 
     // 写回磁盘
     write_block(block_num, buf);
+    pthread_mutex_unlock(&itable_lock);
     Log("iupdate: updated inode %d to disk", ip->inum);
 }
 
-// 根据偏移量获取对应的块号(考虑一级间接块和二级间接块分配的逻辑块号)
-uint bmap(inode *ip, uint bn)
+// extent 的位置: blk 为 0 表示在 inode 内, 否则为所在溢出块的块号
+typedef struct
 {
-    uint addr;
-    uint *indirect_block;
-    uchar buf[BSIZE];
+    uint blk;
+    uint idx;
+} ext_pos;
 
-    // 直接块
-    if (bn < NDIRECT)
+// 在 extent 表中查找逻辑块 bn; 未命中时记录可向后/向前扩展的 extent 和有空位的溢出块
+typedef struct
+{
+    uint addr;      // 命中时的物理块号
+    int has_pred;   // 存在以 bn 结尾的 extent
+    int has_succ;   // 存在从 bn + 1 开始的 extent
+    ext_pos pred, succ;
+    extent pred_e, succ_e;
+    uint room_blk;  // 有空位的溢出块 (0 表示无)
+    uint last_blk;  // 溢出链的最后一块 (0 表示无溢出块)
+    uint last_end;  // 物理位置最靠后的 extent 末尾, 作为分配目标
+} ext_search;
+
+static void extent_check(ext_search *s, extent *e, uint bn, uint blk, uint idx)
+{
+    if (bn - e->lblk < e->len)
     {
-        if ((addr = ip->addrs[bn]) == 0)
-        {
-            ip->addrs[bn] = addr = allocate_block();
-            if (addr == 0)
-            {
-                return 0;
-            }
-            ip->blocks++; // 增加块计数
-            ip->dirty = 1;
-        }
-        return addr;
+        s->addr = e->pblk + (bn - e->lblk);
+        return;
     }
-
-    bn -= NDIRECT;
-    // 一级间接块
-    if (bn < APB)
+    if (e->lblk + e->len == bn)
     {
-        // 分配间接块（如果需要）
-        addr = ip->addrs[NDIRECT];
-        if (addr == 0)
-        {
-            ip->addrs[NDIRECT] = addr = allocate_block();
-            if (addr == 0)
-            {
-                return 0;
-            }
-            ip->blocks++; // 增加间接块计数
-            ip->dirty = 1;
-        }
+        s->has_pred = 1;
+        s->pred = (ext_pos){blk, idx};
+        s->pred_e = *e;
+    }
+    if (e->lblk == bn + 1)
+    {
+        s->has_succ = 1;
+        s->succ = (ext_pos){blk, idx};
+        s->succ_e = *e;
+    }
+    s->last_end = max(s->last_end, e->pblk + e->len);
+}
 
-        read_block(addr, buf);
-        indirect_block = (uint *)buf;
+static void extent_search(inode *ip, uint bn, ext_search *s, int full)
+{
+    memset(s, 0, sizeof(*s));
+    extent *ext = (extent *)ip->addrs;
+    for (uint i = 0; i < ip->addrs[EXT_COUNT] && s->addr == 0; i++)
+        extent_check(s, &ext[i], bn, 0, i);
 
-        // 分配数据块（如果需要）
-        if ((addr = indirect_block[bn]) == 0)
-        {
-            indirect_block[bn] = addr = allocate_block();
-            if (addr == 0)
-            {
-                return 0;
-            }
-            ip->blocks++; // 增加数据块计数
-            write_block(ip->addrs[NDIRECT], buf);
-        }
-        return addr;
+    uint next = ip->addrs[EXT_OVERFLOW];
+    while (next != 0 && s->addr == 0)
+    {
+        extent_block *eb = (extent_block *)imap_get(ip, next);
+        for (uint i = 0; i < eb->count && s->addr == 0; i++)
+            extent_check(s, &eb->e[i], bn, next, i);
+        if (full && eb->count < EXTENTS_PER_BLOCK && s->room_blk == 0)
+            s->room_blk = next; // 分配时才需要记录空位
+        s->last_blk = next;
+        next = eb->next;
     }
+}
 
-    bn -= APB;
-    // 二级间接块 - 类似地添加块计数
-    if (bn < APB * APB)
+// 修改 pos 处的 extent (内联的标记 inode 为脏, 溢出块中的写回该块)
+static void extent_store(inode *ip, ext_pos pos, extent *e)
+{
+    if (pos.blk == 0)
     {
-        // 分配二级间接块（如果需要）
-        if ((addr = ip->addrs[NDIRECT + 1]) == 0)
+        ((extent *)ip->addrs)[pos.idx] = *e;
+        ip->dirty = 1;
+        return;
+    }
+    extent_block *eb = (extent_block *)imap_get(ip, pos.blk);
+    eb->e[pos.idx] = *e;
+    write_block_as(pos.blk, (uchar *)eb, BC_INDIRECT);
+}
+
+// 追加一个新 extent: 先放 inode 内, 再放有空位的溢出块, 都满时链接一个新溢出块
+static int extent_append(inode *ip, ext_search *s, extent *e)
+{
+    if (ip->addrs[EXT_COUNT] < NINLINE_EXT)
+    {
+        ((extent *)ip->addrs)[ip->addrs[EXT_COUNT]++] = *e;
+        ip->dirty = 1;
+        return 0;
+    }
+    uint blk = s->room_blk;
+    if (blk == 0)
+    {
+        blk = allocate_block(); // 新块已清零
+        if (blk == 0)
+            return -1;
+        ip->blocks++;
+        if (s->last_blk == 0)
         {
-            ip->addrs[NDIRECT + 1] = addr = allocate_block();
-            if (addr == 0)
-            {
-                return 0;
-            }
-            ip->blocks++; // 增加二级间接块计数
+            ip->addrs[EXT_OVERFLOW] = blk;
             ip->dirty = 1;
         }
-
-        read_block(addr, buf);
-        indirect_block = (uint *)buf;
-
-        // 分配一级间接块（如果需要）
-        if ((addr = indirect_block[bn / APB]) == 0)
+        else
         {
-            indirect_block[bn / APB] = addr = allocate_block();
-            if (addr == 0)
-            {
-                return 0;
-            }
-            ip->blocks++; // 增加一级间接块计数
-            write_block(ip->addrs[NDIRECT + 1], buf);
+            extent_block *last = (extent_block *)imap_get(ip, s->last_blk);
+            last->next = blk;
+            write_block_as(s->last_blk, (uchar *)last, BC_INDIRECT);
         }
+    }
+    extent_block *eb = (extent_block *)imap_get(ip, blk);
+    eb->e[eb->count++] = *e;
+    write_block_as(blk, (uchar *)eb, BC_INDIRECT);
+    return 0;
+}
 
-        read_block(addr, buf);
-        indirect_block = (uint *)buf;
-
-        // 分配数据块（如果需要）
-        if ((addr = indirect_block[bn % APB]) == 0)
+// 把物理连续的 n 个块 addr.. 记为逻辑块 bn.. 的映射, 能接上前后 extent 时直接扩展
+static int extent_insert(inode *ip, ext_search *s, uint bn, uint addr, uint n)
+{
+    ip->blocks += n;
+    ip->dirty = 1;
+    if (s->has_pred && addr == s->pred_e.pblk + s->pred_e.len)
+    {
+        s->pred_e.len += n;
+        extent_store(ip, s->pred, &s->pred_e);
+    }
+    else if (n == 1 && s->has_succ && addr + 1 == s->succ_e.pblk)
+    {
+        s->succ_e.lblk--;
+        s->succ_e.pblk--;
+        s->succ_e.len++;
+        extent_store(ip, s->succ, &s->succ_e);
+    }
+    else
+    {
+        extent e = {bn, addr, n};
+        if (extent_append(ip, s, &e) < 0)
         {
-            indirect_block[bn % APB] = addr = allocate_block();
-            if (addr == 0)
-            {
-                return 0;
-            }
-            ip->blocks++; // 增加数据块计数
-            write_block(ip->addrs[NDIRECT + 1], buf);
+            ip->blocks -= n;
+            return -1;
         }
-        return addr;
     }
-    Error("bmap: block number %d out of range", bn);
     return 0;
 }
 
-// 从inode中读取数据到dst缓冲区
-int readi(inode *ip, uchar *dst, uint off, uint n)
+// extent inode 的块映射, 需要时分配: 新块尽量紧接前一个 extent 的物理末尾, 使顺序写入的文件只占少数 extent
+static uint extent_bmap(inode *ip, uint bn)
+{
+    ext_search s;
+    extent_search(ip, bn, &s, 1);
+    if (s.addr != 0)
+        return s.addr;
+
+    uint goal = s.last_end;
+    if (s.has_pred)
+        goal = s.pred_e.pblk + s.pred_e.len;
+    else if (s.has_succ && s.succ_e.pblk > 0)
+        goal = s.succ_e.pblk - 1;
+    if (goal == 0)
+        goal = inode_goal(ip);
+    uint addr = allocate_block_near(goal);
+    if (addr == 0)
+        return 0;
+    if (extent_insert(ip, &s, bn, addr, 1) < 0)
+    {
+        free_block(addr);
+        return 0;
+    }
+    return addr;
+}
+
+// 截掉 extent 中逻辑块 keep 及之后的部分并释放这些块; 返回 -1 未变, 0 变短, 1 整个被截掉
+static int extent_cut(extent *e, uint keep, uint *freed)
+{
+    if (e->len == 0 || e->lblk + e->len <= keep)
+        return -1;
+    uint from = e->lblk >= keep ? 0 : keep - e->lblk;
+    for (uint j = from; j < e->len; j++)
+        free_block(e->pblk + j);
+    *freed += e->len - from;
+    e->len = from;
+    return from == 0;
+}
+
+// 截断 extent 表: 被整个截掉的 extent 用同一位置的最后一项填补; keep 为 0 时连同溢出块一起释放
+static uint extent_trunc(inode *ip, uint keep)
+{
+    uint freed = 0;
+    extent *ext = (extent *)ip->addrs;
+    for (uint i = 0; i < ip->addrs[EXT_COUNT];)
+    {
+        if (extent_cut(&ext[i], keep, &freed) == 1)
+            ext[i] = ext[--ip->addrs[EXT_COUNT]];
+        else
+            i++;
+    }
+    // 溢出块中的 extent 被截空后, 从链表中摘下并释放
+    uint prev = 0;
+    uint next = ip->addrs[EXT_OVERFLOW];
+    while (next != 0)
+    {
+        extent_block *eb = (extent_block *)imap_get(ip, next);
+        int changed = 0;
+        for (uint i = 0; i < eb->count;)
+        {
+            int r = extent_cut(&eb->e[i], keep, &freed);
+            changed |= r >= 0;
+            if (r == 1)
+                eb->e[i] = eb->e[--eb->count];
+            else
+                i++;
+        }
+        uint blk = next;
+        next = eb->next;
+        if (eb->count == 0)
+        {
+            if (prev == 0)
+                ip->addrs[EXT_OVERFLOW] = next;
+            else
+            {
+                extent_block *pb = (extent_block *)imap_get(ip, prev);
+                pb->next = next;
+                write_block_as(prev, (uchar *)pb, BC_INDIRECT);
+            }
+            free_block(blk);
+            freed++;
+            continue;
+        }
+        if (changed)
+            write_block_as(blk, (uchar *)eb, BC_INDIRECT);
+        prev = blk;
+    }
+    return freed;
+}
+
+// 释放映射块 blk 中下标 from 及之后的数据块; from 为 0 时整块随后由调用者释放, 不必写回
+static uint table_trunc(inode *ip, uint blk, uint from)
+{
+    uint *a = imap_get(ip, blk);
+    uint freed = 0;
+    for (uint i = from; i < APB; i++)
+    {
+        if (a[i] != 0)
+        {
+            free_block(a[i]);
+            a[i] = 0;
+            freed++;
+        }
+    }
+    if (freed > 0 && from > 0)
+        write_block_as(blk, (uchar *)a, BC_INDIRECT);
+    return freed;
+}
+
+// 截断直接/间接块映射, 不再需要的间接块一起释放
+static uint blockmap_trunc(inode *ip, uint keep)
+{
+    uint freed = 0;
+    for (uint bn = keep; bn < NDIRECT; bn++)
+    {
+        if (ip->addrs[bn] != 0)
+        {
+            free_block(ip->addrs[bn]);
+            ip->addrs[bn] = 0;
+            freed++;
+        }
+    }
+    if (ip->addrs[NDIRECT] != 0)
+    {
+        uint from = keep > NDIRECT ? keep - NDIRECT : 0;
+        if (from < APB)
+            freed += table_trunc(ip, ip->addrs[NDIRECT], from);
+        if (from == 0)
+        {
+            free_block(ip->addrs[NDIRECT]);
+            ip->addrs[NDIRECT] = 0;
+            freed++;
+        }
+    }
+    uint root = ip->addrs[NDIRECT + 1];
+    if (root != 0)
+    {
+        uint base = NDIRECT + APB;
+        uint from = keep > base ? keep - base : 0;
+        uint level1[APB];
+        memcpy(level1, imap_get(ip, root), BSIZE); // 下面读取二级块时映射缓存可能换出一级块
+        int changed = 0;
+        for (uint i = from / APB; i < APB; i++)
+        {
+            if (level1[i] == 0)
+                continue;
+            uint sub = i * APB >= from ? 0 : from - i * APB;
+            freed += table_trunc(ip, level1[i], sub);
+            if (sub == 0)
+            {
+                free_block(level1[i]);
+                level1[i] = 0;
+                freed++;
+                changed = 1;
+            }
+        }
+        if (from == 0)
+        {
+            free_block(root);
+            ip->addrs[NDIRECT + 1] = 0;
+            freed++;
+        }
+        else if (changed)
+        {
+            write_block_as(root, (uchar *)level1, BC_INDIRECT);
+        }
+    }
+    return freed;
+}
+
+// 释放逻辑块 keep 及之后的所有块 (包括延迟分配的块和不再需要的映射块), 文件大小由调用者处理
+uint itrunc(inode *ip, uint keep)
+{
+    da_truncate(ip, keep);
+    if (ip->flags & IF_INLINE)
+        return 0;
+    uint freed = ip->flags & IF_EXTENTS ? extent_trunc(ip, keep) : blockmap_trunc(ip, keep);
+    imap_invalidate(ip);
+    ip->blocks = ip->blocks > freed ? ip->blocks - freed : 0;
+    ip->dirty = 1;
+    Log("itrunc: inode %d freed %d blocks from block %d on", ip->inum, freed, keep);
+    return freed;
+}
+
+// 最后一个已映射逻辑块之后的块号, 没有映射时为 0
+uint inode_mapped_end(inode *ip)
+{
+    if (ip->flags & IF_INLINE)
+        return 0;
+    uint end = 0;
+    if (ip->flags & IF_EXTENTS)
+    {
+        extent *ext = (extent *)ip->addrs;
+        for (uint i = 0; i < ip->addrs[EXT_COUNT]; i++)
+            end = max(end, ext[i].lblk + ext[i].len);
+        for (uint next = ip->addrs[EXT_OVERFLOW]; next != 0;)
+        {
+            extent_block *eb = (extent_block *)imap_get(ip, next);
+            for (uint i = 0; i < eb->count; i++)
+                end = max(end, eb->e[i].lblk + eb->e[i].len);
+            next = eb->next;
+        }
+        return end;
+    }
+    if (ip->addrs[NDIRECT + 1] != 0)
+    {
+        uint level1[APB];
+        memcpy(level1, imap_get(ip, ip->addrs[NDIRECT + 1]), BSIZE);
+        for (int i = APB - 1; i >= 0; i--)
+        {
+            if (level1[i] == 0)
+                continue;
+            uint *a = imap_get(ip, level1[i]);
+            for (int j = APB - 1; j >= 0; j--)
+            {
+                if (a[j] != 0)
+                    return NDIRECT + APB + i * APB + j + 1;
+            }
+        }
+    }
+    if (ip->addrs[NDIRECT] != 0)
+    {
+        uint *a = imap_get(ip, ip->addrs[NDIRECT]);
+        for (int j = APB - 1; j >= 0; j--)
+        {
+            if (a[j] != 0)
+                return NDIRECT + j + 1;
+        }
+    }
+    for (int i = NDIRECT - 1; i >= 0; i--)
+    {
+        if (ip->addrs[i] != 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+// 返回 extent inode 的 extent 数, 块映射的 inode 返回 -1
+int inode_extent_count(inode *ip)
+{
+    if (!(ip->flags & IF_EXTENTS))
+        return -1;
+    if (ip->flags & IF_INLINE)
+        return 0;
+    int n = ip->addrs[EXT_COUNT];
+    uint next = ip->addrs[EXT_OVERFLOW];
+    while (next != 0)
+    {
+        extent_block *eb = (extent_block *)imap_get(ip, next);
+        n += eb->count;
+        next = eb->next;
+    }
+    return n;
+}
+
+static uint bmap_install(inode *ip, uint bn, uint new_addr);
+
+// 根据偏移量获取对应的块号(考虑一级间接块和二级间接块分配的逻辑块号)
+uint bmap(inode *ip, uint bn)
+{
+    if (ip->flags & IF_EXTENTS)
+        return extent_bmap(ip, bn);
+    return bmap_install(ip, bn, 0);
+}
+
+// 块映射 inode: 返回逻辑块 bn 的物理块号, 未映射时映射到 new_addr (为 0 时新分配一块), 需要的间接块按需分配
+static uint bmap_install(inode *ip, uint bn, uint new_addr)
+{
+    uint addr;
+    uint *indirect_block;
+
+    // 直接块
+    if (bn < NDIRECT)
+    {
+        if ((addr = ip->addrs[bn]) == 0)
+        {
+            ip->addrs[bn] = addr = new_addr ? new_addr : alloc_data_block(ip);
+            if (addr == 0)
+            {
+                return 0;
+            }
+            ip->blocks++; // 增加块计数
+            ip->dirty = 1;
+        }
+        return addr;
+    }
+
+    bn -= NDIRECT;
+    // 一级间接块
+    if (bn < APB)
+    {
+        // 分配间接块（如果需要）
+        addr = ip->addrs[NDIRECT];
+        if (addr == 0)
+        {
+            ip->addrs[NDIRECT] = addr = allocate_block();
+            if (addr == 0)
+            {
+                return 0;
+            }
+            ip->blocks++; // 增加间接块计数
+            ip->dirty = 1;
+        }
+
+        indirect_block = imap_get(ip, addr);
+
+        // 分配数据块（如果需要）
+        if ((addr = indirect_block[bn]) == 0)
+        {
+            indirect_block[bn] = addr = new_addr ? new_addr : alloc_data_block(ip);
+            if (addr == 0)
+            {
+                return 0;
+            }
+            ip->blocks++; // 增加数据块计数
+            write_block_as(ip->addrs[NDIRECT], (uchar *)indirect_block, BC_INDIRECT);
+        }
+        return addr;
+    }
+
+    bn -= APB;
+    // 二级间接块 - 类似地添加块计数
+    if (bn < APB * APB)
+    {
+        // 分配二级间接块（如果需要）
+        if ((addr = ip->addrs[NDIRECT + 1]) == 0)
+        {
+            ip->addrs[NDIRECT + 1] = addr = allocate_block();
+            if (addr == 0)
+            {
+                return 0;
+            }
+            ip->blocks++; // 增加二级间接块计数
+            ip->dirty = 1;
+        }
+
+        indirect_block = imap_get(ip, addr);
+
+        // 分配一级间接块（如果需要）
+        if ((addr = indirect_block[bn / APB]) == 0)
+        {
+            indirect_block[bn / APB] = addr = allocate_block();
+            if (addr == 0)
+            {
+                return 0;
+            }
+            ip->blocks++; // 增加一级间接块计数
+            write_block_as(ip->addrs[NDIRECT + 1], (uchar *)indirect_block, BC_INDIRECT);
+        }
+
+        uint indirect_block_addr = addr;
+        indirect_block = imap_get(ip, addr);
+
+        // 分配数据块（如果需要）, 写回的是一级间接块
+        if ((addr = indirect_block[bn % APB]) == 0)
+        {
+            indirect_block[bn % APB] = addr = new_addr ? new_addr : alloc_data_block(ip);
+            if (addr == 0)
+            {
+                return 0;
+            }
+            ip->blocks++; // 增加数据块计数
+            write_block_as(indirect_block_addr, (uchar *)indirect_block, BC_INDIRECT);
+        }
+        return addr;
+    }
+    Error("bmap: block number %d out of range", bn);
+    return 0;
+}
+
+// 只查找不分配: 返回逻辑块对应的物理块号, 空洞(未分配)返回 0
+uint bmap_lookup(inode *ip, uint bn)
+{
+    if (ip->flags & IF_INLINE)
+        return 0;
+    if (ip->flags & IF_EXTENTS)
+    {
+        ext_search s;
+        extent_search(ip, bn, &s, 0);
+        return s.addr;
+    }
+
+    if (bn < NDIRECT)
+        return ip->addrs[bn];
+
+    bn -= NDIRECT;
+    if (bn < APB)
+    {
+        if (ip->addrs[NDIRECT] == 0)
+            return 0;
+        return imap_get(ip, ip->addrs[NDIRECT])[bn];
+    }
+
+    bn -= APB;
+    if (bn < APB * APB)
+    {
+        if (ip->addrs[NDIRECT + 1] == 0)
+            return 0;
+        uint addr = imap_get(ip, ip->addrs[NDIRECT + 1])[bn / APB];
+        if (addr == 0)
+            return 0;
+        return imap_get(ip, addr)[bn % APB];
+    }
+    Error("bmap_lookup: block number %d out of range", bn);
+    return 0;
+}
+
+// 文件扩展到 off 之前, 把旧文件尾到 off 之间已分配块中的残留数据清零 (空洞本身无需处理)
+static void zero_gap(inode *ip, uint off)
+{
+    uchar buf[BSIZE];
+    int cls = ip->type == T_DIR ? BC_DIR : BC_DATA;
+    uint pos = ip->size;
+    while (pos < off)
+    {
+        uint bn = pos / BSIZE;
+        uint start = pos % BSIZE;
+        uint end = min(BSIZE, off - bn * BSIZE);
+        da_block *e = da_find(ip, bn);
+        uint addr = e ? 0 : bmap_lookup(ip, bn);
+        if (e != NULL)
+        {
+            memset(e->data + start, 0, end - start);
+        }
+        else if (addr != 0)
+        {
+            if (start > 0 || end < BSIZE)
+                read_block_as(addr, buf, cls);
+            memset(buf + start, 0, end - start);
+            write_block_as(addr, buf, cls);
+        }
+        pos = (bn + 1) * BSIZE;
+    }
+}
+
+// 顺序读检测: 每个缓存中的 inode 记录下一次顺序读应访问的逻辑块 (ip->seq)
+#define SEQ_STREAM_THRESHOLD 8  // 连续顺序读取超过该块数后按流式读取处理
+#define RA_TRIGGER 2            // 连续顺序读取达到该块数后开始预读
+#define RA_MIN_WINDOW 4         // 预读窗口的初始/最小块数
+#define RA_MAX_WINDOW 64        // 预读窗口的最大块数
+#define WRITE_RUN_MAX 64        // writei 一次分配并写入的最大连续块数
+
+// 记录一次逻辑块读取, 返回该 inode 的顺序读状态
+// 状态在 inode 的缓存槽位中, 和 inode 的其他字段一样由文件系统锁保护
+static seq_state *seq_access(inode *ip, uint bn)
+{
+    seq_state *st = &ip->seq; // 新槽位的状态全零, 与一次随机访问后的状态相同
+    if (st->next_block == bn + 1)
+    {
+        return st; // 同一块内的分段读取
+    }
+    else if (st->next_block != bn)
+    {
+        // 随机访问, 重新计数并缩小预读窗口
+        st->run = 0;
+        st->ra_window /= 2;
+        st->ra_mark = st->ra_end = 0;
+    }
+    st->run++;
+    st->next_block = bn + 1;
+    return st;
+}
+
+// 顺序读时预读后续逻辑块: 读到上一轮预读窗口的后半段时发起下一轮并扩大窗口,
+// 预读的块在使用前已被替换时缩小窗口
+static void readahead(inode *ip, seq_state *st, uint bn, uint addr)
+{
+    uint nblocks = (ip->size + BSIZE - 1) / BSIZE;
+    uint from;
+    if (bn < st->ra_end)
+    {
+        if (!block_cached(addr))
+            st->ra_window = max(RA_MIN_WINDOW, st->ra_window / 2);
+        if (bn < st->ra_mark)
+            return;
+        st->ra_window = min(RA_MAX_WINDOW, st->ra_window * 2);
+        from = st->ra_end; // 紧接上一个窗口
+    }
+    else
+    {
+        st->ra_window = max(RA_MIN_WINDOW, st->ra_window);
+        from = bn + 1;
+    }
+    uint to = min(from + st->ra_window, nblocks);
+    if (from >= to)
+        return;
+    uint addrs[RA_MAX_WINDOW];
+    int n = 0;
+    for (uint b = from; b < to; b++)
+    {
+        uint a = bmap_lookup(ip, b);
+        if (a != 0 && a < sb.size && !block_uninit(a)) // 还没写过的块读出来是全零, 不必预读
+            addrs[n++] = a;
+    }
+    prefetch_blocks(addrs, n, BC_DATA);
+    st->ra_mark = from + (to - from) / 2;
+    st->ra_end = to;
+}
+
+// 按块映射读取 [off, off + n), 不检查文件大小 (片段表文件的日志比文件长)
+static int map_read(inode *ip, uchar *dst, uint off, uint n)
 {
     uint total, bytes_this_iteration; // 总共读取的字节数, 本次读取的字节数
     uint target_block, block_offset;  // 目标块号和块内偏移
     uchar buf[BSIZE];
 
+    for (total = 0; total < n; total += bytes_this_iteration, off += bytes_this_iteration, dst += bytes_this_iteration)
+    {
+        // 计算当前读取位置对应的块号和块内偏移
+        target_block = off / BSIZE;
+        block_offset = off % BSIZE;
+
+        // 获取物理块号, 读取不分配块; 延迟分配的块直接从内存复制
+        da_block *e = da_find(ip, target_block);
+        uint block_addr = e ? 0 : bmap_lookup(ip, target_block);
+
+        // 读取块数据, 顺序扫描的文件数据块不占用热缓存
+        if (e != NULL)
+        {
+            memcpy(buf, e->data, BSIZE);
+        }
+        else if (block_addr == 0)
+        {
+            memset(buf, 0, BSIZE); // 空洞读出全零
+        }
+        else if (ip->type == T_DIR)
+        {
+            read_block_as(block_addr, buf, BC_DIR);
+        }
+        else
+        {
+            seq_state *st = seq_access(ip, target_block);
+            if (st->run >= RA_TRIGGER)
+                readahead(ip, st, target_block, block_addr);
+            if (st->run > SEQ_STREAM_THRESHOLD)
+                read_block_stream(block_addr, buf);
+            else
+                read_block(block_addr, buf);
+        }
+        // 计算本次读取的字节数
+        bytes_this_iteration = BSIZE - block_offset;
+        if (bytes_this_iteration > n - total)
+        {
+            bytes_this_iteration = n - total;
+        }
+        memcpy(dst, buf + block_offset, bytes_this_iteration);
+    }
+    return total;
+}
+
+// 从inode中读取数据到dst缓冲区
+int readi(inode *ip, uchar *dst, uint off, uint n)
+{
     if (ip == NULL || dst == NULL)
     {
-        Error("readi: invalid parameters");
-        return -1;
+        Error("readi: invalid parameters");
+        return -1;
+    }
+    if (off > ip->size)
+    {
+        Error("readi: offset %d beyond file size %d", off, ip->size);
+        return 0;
+    }
+
+    // 调整读取字节数，不能超出文件大小
+    if (off + n > ip->size)
+    {
+        n = ip->size - off;
+        Error("readi: adjusting read size to %d bytes", n);
+    }
+
+    Log("readi: reading %d bytes from inode %d at offset %d", n, ip->inum, off);
+
+    // 内联数据直接从 inode 中复制
+    if (ip->flags & IF_INLINE)
+    {
+        memcpy(dst, (uchar *)ip->addrs + off, n);
+        return n;
+    }
+
+    if (ip->flags & IF_PIECES)
+        return piece_read(ip, dst, off, n);
+    int total = map_read(ip, dst, off, n);
+
+    Log("readi: successfully read %d bytes from inode %d", total, ip->inum);
+    return total;
+}
+
+// 写入内联数据, 越过文件尾的空隙补零
+static int write_inline(inode *ip, uchar *src, uint off, uint n)
+{
+    uchar *data = (uchar *)ip->addrs;
+    if (off > ip->size)
+        memset(data + ip->size, 0, off - ip->size);
+    memcpy(data + off, src, n);
+    if (off + n > ip->size)
+        ip->size = off + n;
+    ip->dirty = 1;
+    iupdate(ip);
+    return n;
+}
+
+// 内联文件长大: 清除内联标志, 把已有内容写入数据块
+static int spill_inline(inode *ip)
+{
+    uchar data[INLINE_MAX];
+    uint size = ip->size;
+    memcpy(data, ip->addrs, size);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->flags &= ~IF_INLINE;
+    ip->size = 0;
+    ip->dirty = 1;
+    Log("spill_inline: inode %d moves %d inline bytes to blocks", ip->inum, size);
+    if (size > 0 && writei(ip, data, 0, size) != size)
+        return -1;
+    return 0;
+}
+
+// 逻辑块 bn 的分配目标: 紧接前一块以保持文件物理连续, 文件开头放在 inode 所在的组
+static uint run_goal(inode *ip, uint bn)
+{
+    uint prev = bn > 0 ? bmap_lookup(ip, bn - 1) : 0;
+    return prev ? prev + 1 : inode_goal(ip);
+}
+
+// 把从 start 开始的 got 个已分配块映射到逻辑块 bn 起, 返回映射成功的块数 (失败的部分已释放)
+static uint map_run(inode *ip, uint bn, uint got, uint start)
+{
+    if (ip->flags & IF_EXTENTS)
+    {
+        ext_search s;
+        extent_search(ip, bn, &s, 1);
+        if (extent_insert(ip, &s, bn, start, got) == 0)
+            return got;
+        for (uint i = 0; i < got; i++)
+            free_block(start + i);
+        return 0;
+    }
+    for (uint i = 0; i < got; i++)
+    {
+        if (bmap_install(ip, bn + i, start + i) != start + i)
+        {
+            // 间接块分配失败, 释放还没有映射的块
+            for (uint j = i; j < got; j++)
+                free_block(start + j);
+            return i;
+        }
+    }
+    return got;
+}
+
+// 追加写从 inode 的预留窗口中取最多 want 个块; 窗口用完或不再紧接文件尾时,
+// 在 goal 处重新预留一个与文件当前长度相当的窗口 (PREALLOC_MIN 到 PREALLOC_MAX 块); 返回取到的块数
+static uint prealloc_take(inode *ip, uint goal, uint bn, uint want, uint *start)
+{
+    if (ip->pa_len > 0 && ip->pa_start != goal)
+        prealloc_drop(ip);
+    if (ip->pa_len == 0)
+    {
+        uint win = max(want, min(PREALLOC_MAX, max(PREALLOC_MIN, bn)));
+        ip->pa_len = reserve_blocks(goal, win, &ip->pa_start, &ip->pa_gen);
+        if (ip->pa_len == 0)
+            return 0;
     }
-    if (off > ip->size)
+    uint n = min(want, ip->pa_len);
+    if (claim_reserved(ip->pa_start, n, ip->pa_gen) < 0)
     {
-        Error("readi: offset %d beyond file size %d", off, ip->size);
+        ip->pa_len = 0; // 空闲区间已重建, 窗口作废
         return 0;
     }
+    *start = ip->pa_start;
+    ip->pa_start += n;
+    ip->pa_len -= n;
+    ip->pa_used = now_ms();
+    return n;
+}
 
-    // 调整读取字节数，不能超出文件大小
-    if (off + n > ip->size)
+// 为从逻辑块 bn 开始的最多 want 个未映射块一次分配物理连续的一段并建立映射, 返回实际映射的块数
+static uint map_new_run(inode *ip, uint bn, uint want, uint *start)
+{
+    uint goal = run_goal(ip, bn);
+    uint got = 0;
+    if (ip->type == T_FILE && bn * BSIZE >= ip->size)
+        got = prealloc_take(ip, goal, bn, want, start);
+    if (got == 0)
+        got = allocate_blocks(goal, want, start);
+    if (got == 0)
+        return 0;
+    return map_run(ip, bn, got, *start);
+}
+
+// 写入从 off 开始、落在未映射块上的数据: 连续的空洞一次分配, 拼成一段后用一次多块写写入
+// 新块不清零也不读取, 首尾不满一块的部分在缓冲区中补零; 返回写入的字节数
+static uint write_new_run(inode *ip, uchar *src, uint off, uint len, int cls)
+{
+    uint bn = off / BSIZE;
+    uint block_offset = off % BSIZE;
+    uint last = (off + len - 1) / BSIZE;
+    uint want = 1;
+    while (want < WRITE_RUN_MAX && bn + want <= last && bmap_lookup(ip, bn + want) == 0 &&
+           da_find(ip, bn + want) == NULL)
+        want++;
+
+    uint start;
+    uint got = map_new_run(ip, bn, want, &start);
+    if (got == 0)
+        return 0;
+
+    uchar run[WRITE_RUN_MAX * BSIZE];
+    uint bytes = min(got * BSIZE - block_offset, len);
+    memset(run, 0, block_offset);
+    memcpy(run + block_offset, src, bytes);
+    memset(run + block_offset + bytes, 0, got * BSIZE - block_offset - bytes);
+    write_blocks_as(start, got, run, cls);
+    return bytes;
+}
+
+static int da_cmp(const void *a, const void *b)
+{
+    uint x = da_pool[*(const int *)a].lblk, y = da_pool[*(const int *)b].lblk;
+    return x < y ? -1 : x > y;
+}
+
+// 为 inode 的延迟块分配物理块并写入: 逻辑上连续的块一次分配成一段并用多块写写入,
+// 文件尾之后的块 (文件已被截短) 直接丢弃; 调用时不能有对该 inode 的写入正在进行
+static void da_flush_inode(inode *ip)
+{
+    if (ip->da_count == 0)
+        return;
+    int idx[DELALLOC_MAX_BLOCKS];
+    int n = 0;
+    for (int i = ip->da_head; i >= 0; i = da_pool[i].next)
+        idx[n++] = i;
+    qsort(idx, n, sizeof(int), da_cmp);
+
+    uint limit = (ip->size + BSIZE - 1) / BSIZE;
+    uchar run[WRITE_RUN_MAX * BSIZE];
+    long written = 0, runs = 0;
+    for (int i = 0; i < n && da_pool[idx[i]].lblk < limit;)
     {
-        n = ip->size - off;
-        Error("readi: adjusting read size to %d bytes", n);
+        int j = i + 1;
+        while (j < n && da_pool[idx[j]].lblk == da_pool[idx[i]].lblk + (j - i) && da_pool[idx[j]].lblk < limit)
+            j++;
+        // [i, j) 是逻辑上连续的一段, 分配器给不出这么长的连续空间时分几段
+        while (i < j)
+        {
+            uint start;
+            uint got = map_new_run(ip, da_pool[idx[i]].lblk, j - i, &start);
+            if (got == 0)
+            {
+                Error("delalloc: no space for %d delayed blocks of inode %d, data lost", j - i, ip->inum);
+                i = j;
+                break;
+            }
+            for (uint k = 0; k < got; k += WRITE_RUN_MAX)
+            {
+                uint c = min(WRITE_RUN_MAX, got - k);
+                for (uint b = 0; b < c; b++)
+                    memcpy(run + b * BSIZE, da_pool[idx[i + k + b]].data, BSIZE);
+                write_blocks_as(start + k, c, run, BC_DATA);
+            }
+            written += got;
+            runs++;
+            i += got;
+        }
+    }
+    Log("delalloc: inode %d wrote %ld of %d delayed blocks in %ld runs", ip->inum, written, n, runs);
+    uint count = ip->da_count;
+    da_release(ip, 0);
+    pthread_mutex_lock(&da_lock);
+    da_flushed += written;
+    da_runs += runs;
+    da_dropped += count - written;
+    pthread_mutex_unlock(&da_lock);
+    ip->dirty = 1;
+    iupdate(ip);
+}
+
+// 命令结束时以及写回线程在命令之间调用: 写回超过 DELALLOC_EXPIRE_MS 的延迟块, 池用掉一半以上或 all 时全部写回
+void delalloc_flush(int all)
+{
+    pthread_once(&icache_once, icache_init);
+    long now = now_ms();
+    if (da_pending > DELALLOC_MAX_BLOCKS / 2)
+        all = 1;
+    pthread_mutex_lock(&icache_lock);
+    for (int i = 0; i < ICACHE_SIZE; i++)
+    {
+        inode *ip = &icache[i];
+        if (ip->valid && ip->da_count > 0 && (all || now - ip->da_since >= DELALLOC_EXPIRE_MS))
+            da_flush_inode(ip);
     }
+    pthread_mutex_unlock(&icache_lock);
+}
 
-    Log("readi: reading %d bytes from inode %d at offset %d", n, ip->inum, off);
+// 按块映射写入 [off, off + n), 未映射的块成段分配; 不检查也不更新文件大小, 返回写入的字节数
+static uint map_write(inode *ip, uchar *src, uint off, uint n, int cls)
+{
+    uint total, bytes_this_iteration; // 总共写入的字节数, 本次写入的字节数
+    uint target_block, block_offset;  // 目标块号和块内偏移
+    uchar buf[BSIZE];
 
-    for (total = 0; total < n; total += bytes_this_iteration, off += bytes_this_iteration, dst += bytes_this_iteration)
+    for (total = 0; total < n; total += bytes_this_iteration, off += bytes_this_iteration, src += bytes_this_iteration)
     {
-        // 计算当前读取位置对应的块号和块内偏移
+        // 计算当前写入位置对应的块号和块内偏移
         target_block = off / BSIZE;
         block_offset = off % BSIZE;
-
-        // 获取物理块号
-        uint block_addr = bmap(ip, target_block);
+        // 获取物理块号, 未映射的块成段分配
+        uint block_addr = bmap_lookup(ip, target_block);
         if (block_addr == 0)
         {
-            Error("readi: failed to get block address for block %d", target_block);
-            break;
+            // 延迟分配: 数据先放在内存中, 写回时整个文件一起分配物理块
+            da_block *e = da_find(ip, target_block);
+            if (e == NULL && da_enabled && ip->type == T_FILE && !(ip->flags & IF_PIECES))
+                e = da_get(ip, target_block);
+            if (e != NULL)
+            {
+                bytes_this_iteration = min(BSIZE - block_offset, n - total);
+                memcpy(e->data + block_offset, src, bytes_this_iteration);
+                continue;
+            }
+            bytes_this_iteration = write_new_run(ip, src, off, n - total, cls);
+            if (bytes_this_iteration == 0)
+            {
+                Error("writei: failed to allocate block for block %d", target_block);
+                break;
+            }
+            continue;
         }
-
-        // 读取块数据
-        read_block(block_addr, buf);
-        // 计算本次读取的字节数
+        // 计算本次写入的字节数
         bytes_this_iteration = BSIZE - block_offset;
         if (bytes_this_iteration > n - total)
         {
             bytes_this_iteration = n - total;
         }
-        memcpy(dst, buf + block_offset, bytes_this_iteration);
+
+        // 如果不是整块写入，需要先读取现有数据
+        if (block_offset > 0 || bytes_this_iteration < BSIZE)
+        {
+            read_block_as(block_addr, buf, cls);
+        }
+        memcpy(buf + block_offset, src, bytes_this_iteration);
+        write_block_as(block_addr, buf, cls);
     }
 
-    Log("readi: successfully read %d bytes from inode %d", total, ip->inum);
     return total;
 }
 
 // 向inode中写入数据
 int writei(inode *ip, uchar *src, uint off, uint n)
 {
-    uint total, bytes_this_iteration; // 总共写入的字节数, 本次写入的字节数
-    uint target_block, block_offset;  // 目标块号和块内偏移
-    uchar buf[BSIZE];
-
     // 参数检查
     if (ip == NULL || src == NULL)
     {
         Error("writei: invalid parameters");
         return -1;
     }
-    uint max_size = MAXFILE;
-    if (off + n > max_size)
+    int cls = ip->type == T_DIR ? BC_DIR : BC_DATA;
+    // 分开比较, 避免 off + n 在 uint 上溢出绕过检查
+    if (off > MAXFILE || n > MAXFILE - off)
     {
         Error("writei: write would exceed maximum file size");
         return -1;
     }
     Log("writei: writing %d bytes to inode %d at offset %d", n, ip->inum, off);
+    if (ip->flags & IF_PIECES)
+        return piece_write(ip, src, off, n);
 
-    for (total = 0; total < n; total += bytes_this_iteration, off += bytes_this_iteration, src += bytes_this_iteration)
+    // 内联文件: 写入后仍放得下则直接写进 inode, 否则先把已有内容搬到数据块
+    if (ip->flags & IF_INLINE)
     {
-        // 计算当前写入位置对应的块号和块内偏移
-        target_block = off / BSIZE;
-        block_offset = off % BSIZE;
-        // 获取物理块号（如果不存在会自动分配）
-        uint block_addr = bmap(ip, target_block);
-        if (block_addr == 0)
+        if (off + n <= INLINE_MAX)
+            return write_inline(ip, src, off, n);
+        if (spill_inline(ip) < 0)
+            return -1;
+    }
+
+    // 越过文件尾写入时中间留下空洞
+    if (off > ip->size)
+        zero_gap(ip, off);
+
+    uint total = map_write(ip, src, off, n, cls);
+
+    // 更新文件大小
+    uint new_size = off + total; // 最后一次写入的偏移量
+    if (new_size > ip->size)
+    {
+        ip->size = new_size;
+        ip->dirty = 1;
+    }
+
+    ip->dirty = 1;
+    Log("writei: successfully wrote %d bytes to inode %d", total, ip->inum);
+    iupdate(ip);
+    return total;
+}
+
+// 预先分配 [0, len) 中还没有映射的块, 文件大小不变; 每段空洞尽量一次分配成连续的一段
+// 新块映射后不会马上写入, 而未初始化标记重启后就丢失, 所以要真正清零 (文件尾之后的块以后也会被写入扩展的文件覆盖到)
+int ifallocate(inode *ip, uint len)
+{
+    if (ip == NULL || len > MAXFILE)
+    {
+        Error("ifallocate: invalid length %d", len);
+        return -1;
+    }
+    if (ip->flags & IF_INLINE)
+    {
+        if (len <= INLINE_MAX)
+            return 0;
+        if (spill_inline(ip) < 0)
+            return -1;
+    }
+    prealloc_drop(ip);
+    da_flush_inode(ip);
+
+    uint nblocks = (len + BSIZE - 1) / BSIZE;
+    int allocated = 0;
+    for (uint bn = 0; bn < nblocks;)
+    {
+        if (bmap_lookup(ip, bn) != 0)
         {
-            Error("writei: failed to allocate block for block %d", target_block);
-            break;
+            bn++;
+            continue;
         }
-        // 计算本次写入的字节数
-        bytes_this_iteration = BSIZE - block_offset;
-        if (bytes_this_iteration > n - total)
+        uint want = 1;
+        while (bn + want < nblocks && bmap_lookup(ip, bn + want) == 0)
+            want++;
+        uint start;
+        uint got = allocate_blocks(run_goal(ip, bn), want, &start);
+        uint mapped = got ? map_run(ip, bn, got, start) : 0; // 没能映射的块已由 map_run 释放
+        if (mapped > 0)
+            zero_blocks(start, mapped);
+        allocated += mapped;
+        if (mapped < got || got == 0)
         {
-            bytes_this_iteration = n - total;
+            Error("ifallocate: out of space after %d blocks for inode %d", allocated, ip->inum);
+            ip->dirty = 1;
+            iupdate(ip);
+            return -1;
         }
+        bn += got;
+    }
+    ip->dirty = 1;
+    iupdate(ip);
+    Log("ifallocate: allocated %d blocks for inode %d (%d bytes)", allocated, ip->inum, len);
+    return allocated;
+}
 
-        // 如果不是整块写入，需要先读取现有数据
-        if (block_offset > 0 || bytes_this_iteration < BSIZE)
+// 把 [off, size) 整体移动 delta 字节, 每次只经过一个块大小的缓冲区, 只改写 off 所在块之后的部分
+// delta > 0 时 [off, off + delta) 的内容未定义, 由调用者写入; delta < 0 时文件变短, 尾部多出的块被释放
+int ishift(inode *ip, uint off, int delta)
+{
+    uchar buf[BSIZE];
+    uint size = ip->size;
+    if (ip->flags & IF_PIECES)
+    {
+        Error("ishift: inode %d uses a piece table, use iinsert/idelete", ip->inum);
+        return -1;
+    }
+    if (off > size || (delta < 0 && off < (uint)-delta) || (delta > 0 && size + delta > MAXFILE))
+    {
+        Error("ishift: cannot move [%d, %d) of inode %d by %d", off, size, ip->inum, delta);
+        return -1;
+    }
+    if (delta == 0 || off == size)
+        return 0;
+
+    if (delta > 0)
+    {
+        // 先把移到原文件尾之后的部分按顺序追加, 新块和普通追加写一样从前往后分配
+        uint d = delta;
+        uint lo = size - min(d, size - off);
+        for (uint src = lo; src < size;)
         {
-            read_block(block_addr, buf);
+            uint n = min(BSIZE - (src + d) % BSIZE, size - src);
+            if (readi(ip, buf, src, n) != n || writei(ip, buf, src + d, n) != n)
+                return -1;
+            src += n;
         }
-        memcpy(buf + block_offset, src, bytes_this_iteration);
-        write_block(block_addr, buf);
+        // 其余部分都落在已有的块中, 从后往前搬, 每次写满一个目标块
+        for (uint end = lo; end > off;)
+        {
+            uint n = (end + d) % BSIZE;
+            n = min(n ? n : BSIZE, end - off);
+            end -= n;
+            if (readi(ip, buf, end, n) != n || writei(ip, buf, end + d, n) != n)
+                return -1;
+        }
+    }
+    else
+    {
+        // 从前往后搬, 然后截掉文件尾不再需要的块
+        uint d = -delta;
+        for (uint src = off; src < size;)
+        {
+            uint n = min(BSIZE - (src - d) % BSIZE, size - src);
+            if (readi(ip, buf, src, n) != n || writei(ip, buf, src - d, n) != n)
+                return -1;
+            src += n;
+        }
+        ip->size = size - d;
+        itrunc(ip, (ip->size + BSIZE - 1) / BSIZE);
+        iupdate(ip);
     }
+    Log("ishift: moved [%d, %d) of inode %d by %d", off, size, ip->inum, delta);
+    return 0;
+}
 
-    // 更新文件大小
-    uint new_size = off; // 最后一次写入的偏移量
-    if (new_size > ip->size)
+// 片段表文件: 数据块按追加顺序保存原始内容和所有插入的字节 (日志), 文件内容是片段依次拼接的结果
+// 插入只在日志尾追加并改表, 删除只改表; 片段过多时压缩回一个覆盖整个日志的片段
+
+// 读出整张片段表, 返回片段数, 表损坏时返回 -1
+static int pt_load(inode *ip, piece *pt, uint *log_size)
+{
+    piece_block pb;
+    uint count = 0;
+    *log_size = 0;
+    for (uint next = ip->addrs[PT_HEAD], i = 0; next != 0; next = pb.next, i++)
     {
-        ip->size = new_size;
-        ip->dirty = 1;
+        read_block_as(next, (uchar *)&pb, BC_INDIRECT);
+        if (i == 0)
+            *log_size = pb.log_size;
+        if (i >= PT_MAX_BLOCKS || pb.count > PIECES_PER_BLOCK)
+        {
+            Error("pt_load: corrupt piece table of inode %d", ip->inum);
+            return -1;
+        }
+        memcpy(pt + count, pb.p, pb.count * sizeof(piece));
+        count += pb.count;
+    }
+    return count;
+}
+
+// 写回整张片段表: 沿用已有的表块, 不够时在表头附近分配, 多出的释放
+static int pt_store(inode *ip, piece *pt, uint count, uint log_size)
+{
+    uint blks[PT_MAX_BLOCKS], have = 0;
+    piece_block pb;
+    for (uint next = ip->addrs[PT_HEAD]; next != 0 && have < PT_MAX_BLOCKS; next = pb.next)
+    {
+        read_block_as(next, (uchar *)&pb, BC_INDIRECT);
+        blks[have++] = next;
+    }
+    uint need = max(1, (count + PIECES_PER_BLOCK - 1) / PIECES_PER_BLOCK);
+    for (; have < need; have++)
+    {
+        blks[have] = allocate_block_near(have > 0 ? blks[have - 1] : inode_goal(ip));
+        if (blks[have] == 0)
+        {
+            Error("pt_store: no space for the piece table of inode %d", ip->inum);
+            return -1;
+        }
+        ip->blocks++;
+    }
+    for (; have > need; have--)
+    {
+        free_block(blks[have - 1]);
+        ip->blocks--;
+    }
+    for (uint i = 0; i < need; i++)
+    {
+        memset(&pb, 0, sizeof(pb));
+        pb.count = min(PIECES_PER_BLOCK, count - i * PIECES_PER_BLOCK);
+        pb.next = i + 1 < need ? blks[i + 1] : 0;
+        pb.log_size = log_size;
+        pb.total = count;
+        memcpy(pb.p, pt + i * PIECES_PER_BLOCK, pb.count * sizeof(piece));
+        write_block_as(blks[i], (uchar *)&pb, BC_INDIRECT);
     }
+    ip->addrs[PT_HEAD] = blks[0];
+    ip->dirty = 1;
+    return 0;
+}
 
+static void pt_free(inode *ip)
+{
+    piece_block pb;
+    for (uint next = ip->addrs[PT_HEAD], i = 0; next != 0 && i < PT_MAX_BLOCKS; next = pb.next, i++)
+    {
+        read_block_as(next, (uchar *)&pb, BC_INDIRECT);
+        free_block(next);
+        ip->blocks = ip->blocks > 0 ? ip->blocks - 1 : 0;
+    }
+    ip->addrs[PT_HEAD] = 0;
+    ip->flags &= ~IF_PIECES;
     ip->dirty = 1;
-    Log("writei: successfully wrote %d bytes to inode %d", total, ip->inum);
-    iupdate(ip);
+}
+
+// 在文件偏移 pos 处切开片段, 返回从 pos 开始的片段下标 (pos 在文件尾时返回 count)
+static uint pt_split(piece *pt, uint *count, uint pos)
+{
+    uint i = 0;
+    for (; i < *count && pos >= pt[i].len; i++)
+        pos -= pt[i].len;
+    if (i == *count || pos == 0)
+        return i;
+    memmove(pt + i + 2, pt + i + 1, (*count - i - 1) * sizeof(piece));
+    pt[i + 1].off = pt[i].off + pos;
+    pt[i + 1].len = pt[i].len - pos;
+    pt[i].len = pos;
+    (*count)++;
+    return i + 1;
+}
+
+static int piece_read(inode *ip, uchar *dst, uint off, uint n)
+{
+    piece pt[PIECE_MAX];
+    uint log_size;
+    int count = pt_load(ip, pt, &log_size);
+    if (count < 0)
+        return -1;
+    uint total = 0;
+    for (int i = 0; i < count && total < n; i++)
+    {
+        if (off >= pt[i].len)
+        {
+            off -= pt[i].len;
+            continue;
+        }
+        uint c = min(pt[i].len - off, n - total);
+        if (map_read(ip, dst + total, pt[i].off + off, c) != c)
+            return -1;
+        total += c;
+        off = 0;
+    }
+    Log("readi: read %d bytes from %d pieces of inode %d", total, count, ip->inum);
     return total;
 }
 
+// 把片段表文件写成平坦布局: 日志前部已经按顺序排好的片段原地保留, 其余内容先复制到日志尾,
+// 改表指向这份副本后再搬回前部, 最后截掉多余的块; 任何时刻落盘的表都指向完整的内容
+int icompact(inode *ip)
+{
+    if (!(ip->flags & IF_PIECES))
+        return 0;
+    piece pt[PIECE_MAX];
+    uchar buf[BSIZE];
+    uint log_size;
+    int count = pt_load(ip, pt, &log_size);
+    if (count < 0)
+        return -1;
+    uint size = ip->size; // 文件被截短时 (如 w 先把大小置 0) 只保留前 size 字节
+    uint done = 0;
+    int i = 0;
+    while (i < count && pt[i].off == done && done < size)
+        done += pt[i++].len;
+    done = min(done, size);
+
+    if (done < size)
+    {
+        uint tail = (log_size + BSIZE - 1) / BSIZE * BSIZE; // 副本从块边界开始
+        uint pos = 0;
+        for (; i < count && done + pos < size; i++)
+        {
+            uint len = min(pt[i].len, size - done - pos);
+            for (uint k = 0; k < len;)
+            {
+                uint c = min(BSIZE, len - k);
+                if (map_read(ip, buf, pt[i].off + k, c) != c || map_write(ip, buf, tail + pos, c, BC_DATA) != c)
+                    return -1;
+                k += c;
+                pos += c;
+            }
+        }
+        piece staged[2] = {{0, done}, {tail, size - done}};
+        int first = done > 0 ? 0 : 1;
+        if (pt_store(ip, staged + first, 2 - first, tail + size - done) < 0)
+            return -1;
+        iupdate(ip);
+        for (uint k = 0; k < size - done;)
+        {
+            uint c = min(BSIZE - (done + k) % BSIZE, size - done - k);
+            if (map_read(ip, buf, tail + k, c) != c || map_write(ip, buf, done + k, c, BC_DATA) != c)
+                return -1;
+            k += c;
+        }
+    }
+    piece whole = {0, size};
+    if (pt_store(ip, &whole, size > 0, size) < 0)
+        return -1;
+    itrunc(ip, (size + BSIZE - 1) / BSIZE);
+    iupdate(ip);
+    Log("icompact: inode %d compacted from %d pieces (%d log bytes) to %d bytes", ip->inum, count, log_size, size);
+    return 0;
+}
+
+// 片段表文件的普通写入: 覆盖文件内的字节时删掉被覆盖的部分再插入新数据, 仍然只改表;
+// 越过文件尾或文件被调用者截短 (表与文件大小不一致) 时先压缩成平坦布局, 按普通文件写入后再恢复成一个片段
+static int piece_write(inode *ip, uchar *src, uint off, uint n)
+{
+    piece pt[PIECE_MAX];
+    uint log_size, total = 0;
+    int count = pt_load(ip, pt, &log_size);
+    for (int i = 0; i < count; i++)
+        total += pt[i].len;
+    if (count >= 0 && total == ip->size && off <= ip->size)
+    {
+        if (idelete(ip, off, min(n, ip->size - off)) < 0 || iinsert(ip, off, src, n) < 0)
+            return -1;
+        return n;
+    }
+    if (icompact(ip) < 0)
+        return -1;
+    ip->flags &= ~IF_PIECES;
+    int r = writei(ip, src, off, n);
+    da_flush_inode(ip); // 日志中的块不能留在延迟分配池里, 池按文件大小丢弃文件尾之后的块
+    ip->flags |= IF_PIECES;
+    piece whole = {0, ip->size};
+    if (pt_store(ip, &whole, ip->size > 0, ip->size) < 0)
+        return -1;
+    iupdate(ip);
+    return r;
+}
+
+int piece_count(inode *ip)
+{
+    if (!(ip->flags & IF_PIECES) || ip->addrs[PT_HEAD] == 0)
+        return -1;
+    piece_block pb;
+    read_block_as(ip->addrs[PT_HEAD], (uchar *)&pb, BC_INDIRECT);
+    return pb.total;
+}
+
+int ipieces(inode *ip, int on)
+{
+    if (!on)
+    {
+        if (!(ip->flags & IF_PIECES))
+            return 0;
+        if (icompact(ip) < 0)
+            return -1;
+        pt_free(ip);
+        iupdate(ip);
+        Log("ipieces: inode %d back to a flat file", ip->inum);
+        return 0;
+    }
+    if (ip->flags & IF_PIECES)
+        return 0;
+    if (ip->type != T_FILE)
+    {
+        Error("ipieces: inode %d is not a file", ip->inum);
+        return -1;
+    }
+    if ((ip->flags & IF_INLINE) && spill_inline(ip) < 0)
+        return -1;
+    if (!(ip->flags & IF_EXTENTS) && (ip->size > 0 || ip->blocks > 0))
+    {
+        Error("ipieces: inode %d uses block maps, piece tables need extents", ip->inum);
+        return -1;
+    }
+    ip->flags |= IF_EXTENTS; // 空的块映射文件可以直接换成 extent
+    da_flush_inode(ip);      // 日志不使用延迟分配, 其长度与文件大小无关
+    piece whole = {0, ip->size};
+    if (pt_store(ip, &whole, ip->size > 0, ip->size) < 0)
+        return -1;
+    ip->flags |= IF_PIECES;
+    iupdate(ip);
+    Log("ipieces: inode %d now uses a piece table", ip->inum);
+    return 0;
+}
+
+int iinsert(inode *ip, uint pos, uchar *src, uint n)
+{
+    if (pos > ip->size || ip->size + n > MAXFILE)
+    {
+        Error("iinsert: cannot insert %d bytes at %d into inode %d", n, pos, ip->inum);
+        return -1;
+    }
+    if (!(ip->flags & IF_PIECES))
+    {
+        if (ishift(ip, pos, n) < 0 || writei(ip, src, pos, n) != n)
+            return -1;
+        return 0;
+    }
+    if (piece_count(ip) + 2 > PIECE_MAX && icompact(ip) < 0)
+        return -1;
+    piece pt[PIECE_MAX];
+    uint log_size;
+    int loaded = pt_load(ip, pt, &log_size);
+    if (loaded < 0)
+        return -1;
+    uint count = loaded;
+    if (log_size + n > MAXFILE)
+    {
+        if (icompact(ip) < 0 || (loaded = pt_load(ip, pt, &log_size)) < 0 || log_size + n > MAXFILE)
+            return -1;
+        count = loaded;
+    }
+    // 新数据追加到日志尾; 接着上一次插入继续输入时直接延长前一个片段
+    if (map_write(ip, src, log_size, n, BC_DATA) != n)
+        return -1;
+    uint i = pt_split(pt, &count, pos);
+    if (i > 0 && pt[i - 1].off + pt[i - 1].len == log_size)
+    {
+        pt[i - 1].len += n;
+    }
+    else
+    {
+        memmove(pt + i + 1, pt + i, (count - i) * sizeof(piece));
+        pt[i].off = log_size;
+        pt[i].len = n;
+        count++;
+    }
+    ip->size += n;
+    if (pt_store(ip, pt, count, log_size + n) < 0)
+        return -1;
+    iupdate(ip);
+    return 0;
+}
+
+int idelete(inode *ip, uint pos, uint n)
+{
+    if (pos + n > ip->size)
+    {
+        Error("idelete: cannot delete %d bytes at %d from inode %d", n, pos, ip->inum);
+        return -1;
+    }
+    if (!(ip->flags & IF_PIECES))
+        return ishift(ip, pos + n, -(int)n);
+    if (piece_count(ip) + 2 > PIECE_MAX && icompact(ip) < 0)
+        return -1;
+    piece pt[PIECE_MAX];
+    uint log_size;
+    int loaded = pt_load(ip, pt, &log_size);
+    if (loaded < 0)
+        return -1;
+    uint count = loaded;
+    uint a = pt_split(pt, &count, pos);
+    uint b = pt_split(pt, &count, pos + n);
+    memmove(pt + a, pt + b, (count - b) * sizeof(piece));
+    count -= b - a;
+    ip->size -= n;
+    if (pt_store(ip, pt, count, log_size) < 0)
+        return -1;
+    iupdate(ip);
+    return 0;
+}
+
+// 命令结束时调用: 压缩缓存中片段数超过 PIECE_COMPACT 的文件, 编辑命令本身只改表
+void piece_compact_pending(void)
+{
+    pthread_once(&icache_once, icache_init);
+    pthread_mutex_lock(&icache_lock);
+    for (int i = 0; i < ICACHE_SIZE; i++)
+    {
+        inode *ip = &icache[i];
+        if (ip->valid && ip->type == T_FILE && (ip->flags & IF_PIECES) && piece_count(ip) > PIECE_COMPACT)
+            icompact(ip);
+    }
+    pthread_mutex_unlock(&icache_lock);
+}
+
 // 初始化 inode 系统
 void init_inode_system()
 {
@@ -551,15 +2299,12 @@ void init_inode_system()
         memcpy(buf + i * sizeof(dinode), &empty_inode, sizeof(dinode));
     }
 
-    // 计算需要多少个块来存储所有 inode
-    uint inodes_per_block = BSIZE / sizeof(dinode);
-    uint inode_blocks = (sb.ninodes + inodes_per_block - 1) / inodes_per_block;
-
-    // 写入所有 inode 块
-    for (uint i = 0; i < inode_blocks; i++)
+    // 写入所有 inode 块 (使用柱面组时分散在各组中)
+    for (uint inum = 0; inum < sb.ninodes; inum += BSIZE / sizeof(dinode))
     {
-        write_block(sb.inodestart + i, buf);
+        write_block(inode_block(inum), buf);
     }
 
+    icache_invalidate();
     Log("Inode system initialized successfully");
 }
\ No newline at end of file
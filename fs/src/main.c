@@ -250,7 +250,7 @@ int main(int argc, char *argv[])
     get_disk_info(&ncyl, &nsec);
 
     // read the superblock
-    sbinit();
+    sbinit(ncyl, nsec);
 
     static char buf[4096];
     while (1)
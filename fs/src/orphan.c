@@ -0,0 +1,225 @@
+#include "orphan.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "bitmap.h"
+#include "block.h"
+#include "fs.h"
+#include "fs_internal.h"
+#include "inode.h"
+#include "log.h"
+
+// 孤儿表保存在超级块中 (sb.orphans), 修改后立即写回块 0, 重启后由回收线程继续处理
+// orphan_lock 保护孤儿表和回收线程的状态
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t orphan_cond = PTHREAD_COND_INITIALIZER; // 有新的孤儿 / 要求线程退出
+static pthread_t reclaim_thread;
+static int reclaim_running = 0;
+static long reclaimed_inodes = 0, reclaimed_blocks = 0, reclaim_batches = 0;
+
+int orphan_full(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    int full = sb.norphan >= NORPHAN;
+    pthread_mutex_unlock(&orphan_lock);
+    return full;
+}
+
+int orphan_pending(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    int n = sb.norphan;
+    pthread_mutex_unlock(&orphan_lock);
+    return n;
+}
+
+// 把已标记为孤儿 (nlink 为 0, IF_ORPHAN) 的 inode 记入孤儿表并唤醒回收线程, 表满时返回 -1
+int orphan_add(uint inum)
+{
+    pthread_mutex_lock(&orphan_lock);
+    if (sb.norphan >= NORPHAN)
+    {
+        pthread_mutex_unlock(&orphan_lock);
+        Warn("orphan_add: orphan table full, inode %d not queued", inum);
+        return -1;
+    }
+    sb.orphans[sb.norphan++] = inum;
+    write_sb();
+    pthread_cond_signal(&orphan_cond);
+    pthread_mutex_unlock(&orphan_lock);
+    Log("orphan_add: inode %d queued for reclamation", inum);
+    return 0;
+}
+
+static void orphan_remove(uint inum)
+{
+    pthread_mutex_lock(&orphan_lock);
+    for (uint i = 0; i < sb.norphan; i++)
+    {
+        if (sb.orphans[i] == inum)
+        {
+            sb.orphans[i] = sb.orphans[--sb.norphan];
+            sb.orphans[sb.norphan] = 0;
+            write_sb();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&orphan_lock);
+}
+
+// 回收孤儿 inode 的一批: 从文件尾开始释放 RECLAIM_BATCH 个逻辑块并写回 inode 和位图,
+// 中途停止或崩溃时已释放的块不再出现在映射中, 下次从剩下的部分继续; 映射为空时由 iput 释放 inode 本身
+// 调用者持有文件系统锁, 所以不会与请求线程同时修改 icache 中的 inode 或块映射;
+// 批与批之间不保留 inode 的引用, 返回 1 表示这个孤儿已处理完
+static int reclaim_batch(uint inum)
+{
+    inode *ip = iget(inum);
+    if (ip == NULL || ip->nlink != 0 || !(ip->flags & IF_ORPHAN))
+    {
+        // 已经回收完 (重启前, 或由持锁的 reclaim_drain), 或者 inode 号已被重新使用
+        Log("reclaim: inode %d is no longer an orphan, dropping it from the table", inum);
+        iput(ip);
+        orphan_remove(inum);
+        return 1;
+    }
+    uint end = inode_mapped_end(ip);
+    if (end > 0)
+    {
+        uint keep = end > RECLAIM_BATCH ? end - RECLAIM_BATCH : 0;
+        uint n = itrunc(ip, keep);
+        iupdate(ip);
+        iput(ip); // 孤儿 inode 的最后一个引用不释放块
+        bitmap_sync();
+        pthread_mutex_lock(&orphan_lock);
+        reclaimed_blocks += n;
+        reclaim_batches++;
+        pthread_mutex_unlock(&orphan_lock);
+        return 0;
+    }
+    ip->flags &= ~IF_ORPHAN;
+    ip->dirty = 1;
+    iput(ip); // nlink 为 0 的最后一个引用: 释放剩下的映射块和 inode
+    bitmap_sync();
+    pthread_mutex_lock(&orphan_lock);
+    reclaimed_inodes++;
+    pthread_mutex_unlock(&orphan_lock);
+    orphan_remove(inum);
+    Log("reclaim: inode %d reclaimed", inum);
+    return 1;
+}
+
+// 回收一个孤儿 inode; background 表示由回收线程执行: 每批各自持有文件系统锁, 批间让请求线程执行命令,
+// 线程被要求退出时在批之间停下并返回 -1
+static int reclaim_inode(uint inum, int background)
+{
+    for (;;)
+    {
+        if (background && !reclaim_active())
+        {
+            Log("reclaim: stopped in inode %d", inum);
+            return -1;
+        }
+        if (background)
+            fs_lock();
+        int done = reclaim_batch(inum);
+        if (background)
+            fs_unlock();
+        if (done)
+            return 0;
+        if (background)
+            sched_yield();
+    }
+}
+
+static void *reclaim_main(void *arg)
+{
+    Log("reclaim thread started (%d orphans pending)", sb.norphan);
+    pthread_mutex_lock(&orphan_lock);
+    while (reclaim_running)
+    {
+        if (sb.norphan == 0)
+        {
+            pthread_cond_wait(&orphan_cond, &orphan_lock);
+            continue;
+        }
+        uint inum = sb.orphans[0];
+        pthread_mutex_unlock(&orphan_lock);
+        reclaim_inode(inum, 1);
+        pthread_mutex_lock(&orphan_lock);
+    }
+    pthread_mutex_unlock(&orphan_lock);
+    Log("reclaim thread stopped");
+    return NULL;
+}
+
+// 启动回收线程, 挂载时孤儿表中留下的 inode 随即继续回收
+int reclaim_start(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    if (reclaim_running)
+    {
+        pthread_mutex_unlock(&orphan_lock);
+        return 0;
+    }
+    reclaim_running = 1;
+    pthread_mutex_unlock(&orphan_lock);
+
+    if (pthread_create(&reclaim_thread, NULL, reclaim_main, NULL) != 0)
+    {
+        Error("reclaim_start: failed to create reclaim thread");
+        pthread_mutex_lock(&orphan_lock);
+        reclaim_running = 0;
+        pthread_mutex_unlock(&orphan_lock);
+        return -1;
+    }
+    return 0;
+}
+
+// 停止回收线程; 正在回收的 inode 在当前批结束后停下, 留在孤儿表中
+void reclaim_stop(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    if (!reclaim_running)
+    {
+        pthread_mutex_unlock(&orphan_lock);
+        return;
+    }
+    reclaim_running = 0;
+    pthread_cond_signal(&orphan_cond);
+    pthread_mutex_unlock(&orphan_lock);
+    pthread_join(reclaim_thread, NULL);
+}
+
+int reclaim_active(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    int running = reclaim_running;
+    pthread_mutex_unlock(&orphan_lock);
+    return running;
+}
+
+// 调用者持有文件系统锁 (或者没有其他线程), 回收线程此时只会停在两批之间, 由调用者直接回收
+void reclaim_drain(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    while (sb.norphan > 0)
+    {
+        uint inum = sb.orphans[0];
+        pthread_mutex_unlock(&orphan_lock);
+        reclaim_inode(inum, 0);
+        pthread_mutex_lock(&orphan_lock);
+    }
+    pthread_mutex_unlock(&orphan_lock);
+}
+
+int reclaim_format_stats(char *out, int size)
+{
+    pthread_mutex_lock(&orphan_lock);
+    int n = snprintf(out, size, "reclaim: %d orphans pending, %ld inodes reclaimed, %ld blocks in %ld batches%s",
+                     sb.norphan, reclaimed_inodes, reclaimed_blocks, reclaim_batches,
+                     reclaim_running ? "" : " (no reclaim thread)");
+    pthread_mutex_unlock(&orphan_lock);
+    return n < size ? n : size - 1;
+}
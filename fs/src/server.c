@@ -3,14 +3,18 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "log.h"
 #include "tcp_utils.h"
 #include "block.h"
+#include "orphan.h"
 #include "common.h"
 #include "fs.h"
 #include "user.h"
 #include "connection.h"
+#include "simple_cache.h"
 
 int ncyl, nsec;
 static int current_connection_id = 0; // 当前连接ID
@@ -47,9 +51,43 @@ static char get_file_type_char(short type)
     }
 }
 
+// 解析非负十进制整数, 含非数字字符或超出 uint 范围时返回 -1
+static int parse_uint(const char *s, uint *out)
+{
+    if (s == NULL || *s == '\0')
+        return -1;
+    unsigned long long v = 0;
+    for (; *s; s++)
+    {
+        if (*s < '0' || *s > '9')
+            return -1;
+        v = v * 10 + (*s - '0');
+        if (v > 0xFFFFFFFFull)
+            return -1;
+    }
+    *out = (uint)v;
+    return 0;
+}
+
 int handle_f(tcp_buffer *wb, char *args, int len)
 {
-    if (cmd_f(ncyl, nsec) == E_SUCCESS)
+    // 可选参数选择块映射方式: extents (默认) 或 blockmap (直接/间接块), flat 表示不划分柱面组
+    uint features = FS_DEFAULT_FEATURES;
+    if (len > 0 && args[0] != '\0')
+    {
+        if (strcmp(args, "extents") == 0)
+            features = FEAT_EXTENTS | FEAT_CGROUPS;
+        else if (strcmp(args, "blockmap") == 0)
+            features = FEAT_CGROUPS;
+        else if (strcmp(args, "flat") == 0)
+            features = FS_DEFAULT_FEATURES & ~FEAT_CGROUPS;
+        else
+        {
+            reply_with_no(wb, "Usage: f [extents|blockmap|flat]", strlen("Usage: f [extents|blockmap|flat]"));
+            return 0;
+        }
+    }
+    if (cmd_format(ncyl, nsec, features) == E_SUCCESS)
     {
         reply_with_yes(wb, NULL, 0);
         Log("Format success");
@@ -202,25 +240,69 @@ int handle_ls(tcp_buffer *wb, char *args, int len)
     return 0;
 }
 
-int handle_cat(tcp_buffer *wb, char *args, int len)
+// 流式回复: 每段数据一个 "More" 包, 写缓冲区放不下下一个包时先发出去;
+// 第一段立即发出, 客户端不必等整个文件读完
+typedef struct
 {
-    
-    char *name = args;
-    uchar *buf = NULL;
-    uint file_len;
+    tcp_buffer *wb;
+    int frames; // 已经放入写缓冲区的包数
+} read_stream;
 
-    if (cmd_cat(name, &buf, &file_len) == E_SUCCESS)
+static int emit_more(void *arg, const uchar *data, uint n)
+{
+    read_stream *rs = arg;
+    // 客户端不再读取时停止, 连接随后被关闭, 不能让后面的包和 "Yes" 冒充完整的回复
+    if (TCP_BUF_SIZE - rs->wb->write_index < (int)n + 9 && server_flush(rs->wb) < 0)
+        return -1;
+    reply_with_more(rs->wb, (const char *)data, n);
+    if (rs->frames++ == 0 && server_flush(rs->wb) < 0)
+        return -1;
+    return 0;
+}
+
+// 读取 [off, off + len) 并以 "More" 包流式发送, 最后以 "Yes" 或 "No" 结束
+static void stream_file(tcp_buffer *wb, char *name, uint off, uint len)
+{
+    read_stream rs = {wb, 0};
+    if (cmd_read(name, off, len, emit_more, &rs) == E_SUCCESS)
     {
-        reply_with_yes(wb, (char *)buf, file_len);
-        Log("Read file success: %s, length: %d", name, file_len);
-        free(buf);
+        reply_with_yes(wb, NULL, 0);
+        Log("Read file success: %s, offset: %d, %d frames", name, off, rs.frames);
     }
     else
     {
         reply_with_no(wb, "Failed to read file", strlen("Failed to read file"));
         Warn("Failed to read file: %s", name);
     }
+}
+
+int handle_cat(tcp_buffer *wb, char *args, int len)
+{
+    char *name = strtok(args, " ");
+    if (!name)
+    {
+        reply_with_no(wb, "Invalid arguments for cat", strlen("Invalid arguments for cat"));
+        Warn("Invalid arguments for cat");
+        return 0;
+    }
+    stream_file(wb, name, 0, MAXFILE);
+    return 0;
+}
+
+int handle_read_range(tcp_buffer *wb, char *args, int len)
+{
+    char *name = strtok(args, " ");
+    char *off_str = strtok(NULL, " ");
+    char *len_str = strtok(NULL, " ");
+    uint off, data_len;
 
+    if (!name || parse_uint(off_str, &off) < 0 || parse_uint(len_str, &data_len) < 0)
+    {
+        reply_with_no(wb, "Invalid arguments for read", strlen("Invalid arguments for read"));
+        Warn("Invalid arguments for read");
+        return 0;
+    }
+    stream_file(wb, name, off, data_len);
     return 0;
 }
 
@@ -285,6 +367,64 @@ int handle_i(tcp_buffer *wb, char *args, int len)
     return 0;
 }
 
+int handle_pwrite(tcp_buffer *wb, char *args, int len)
+{
+    char *name = strtok(args, " ");
+    char *off_str = strtok(NULL, " ");
+    char *len_str = strtok(NULL, " ");
+    char *data = strtok(NULL, "");
+    uint off, data_len;
+
+    if (!name || !data || parse_uint(off_str, &off) < 0 || parse_uint(len_str, &data_len) < 0 ||
+        strlen(data) < data_len)
+    {
+        reply_with_no(wb, "Invalid arguments for pwrite", strlen("Invalid arguments for pwrite"));
+        Warn("Invalid arguments for pwrite");
+        return 0;
+    }
+
+    if (cmd_pwrite(name, off, data_len, data) == E_SUCCESS)
+    {
+        reply_with_yes(wb, NULL, 0);
+        Log("Pwrite success: %s, offset: %d, length: %d", name, off, data_len);
+    }
+    else
+    {
+        reply_with_no(wb, "Failed to write file", strlen("Failed to write file"));
+        Warn("Failed to pwrite file: %s", name);
+    }
+
+    return 0;
+}
+
+int handle_append(tcp_buffer *wb, char *args, int len)
+{
+    char *name = strtok(args, " ");
+    char *len_str = strtok(NULL, " ");
+    char *data = strtok(NULL, "");
+    uint data_len;
+
+    if (!name || !data || parse_uint(len_str, &data_len) < 0 || strlen(data) < data_len)
+    {
+        reply_with_no(wb, "Invalid arguments for append", strlen("Invalid arguments for append"));
+        Warn("Invalid arguments for append");
+        return 0;
+    }
+
+    if (cmd_append(name, data_len, data) == E_SUCCESS)
+    {
+        reply_with_yes(wb, NULL, 0);
+        Log("Append success: %s, length: %d", name, data_len);
+    }
+    else
+    {
+        reply_with_no(wb, "Failed to append to file", strlen("Failed to append to file"));
+        Warn("Failed to append to file: %s", name);
+    }
+
+    return 0;
+}
+
 int handle_d(tcp_buffer *wb, char *args, int len)
 {
     char *name = strtok(args, " ");
@@ -315,6 +455,60 @@ int handle_d(tcp_buffer *wb, char *args, int len)
     return 0;
 }
 
+int handle_fallocate(tcp_buffer *wb, char *args, int len)
+{
+    char *name = strtok(args, " ");
+    char *len_str = strtok(NULL, " ");
+    uint data_len;
+
+    if (!name || parse_uint(len_str, &data_len) < 0)
+    {
+        reply_with_no(wb, "Invalid arguments for fallocate", strlen("Invalid arguments for fallocate"));
+        Warn("Invalid arguments for fallocate");
+        return 0;
+    }
+
+    if (cmd_fallocate(name, data_len) == E_SUCCESS)
+    {
+        reply_with_yes(wb, NULL, 0);
+        Log("Fallocate success: %s, length: %d", name, data_len);
+    }
+    else
+    {
+        reply_with_no(wb, "Failed to allocate space", strlen("Failed to allocate space"));
+        Warn("Failed to allocate space: %s", name);
+    }
+
+    return 0;
+}
+
+int handle_pieces(tcp_buffer *wb, char *args, int len)
+{
+    char *name = strtok(args, " ");
+    char *mode = strtok(NULL, " ");
+
+    if (!name || !mode || (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0))
+    {
+        reply_with_no(wb, "Usage: pieces <name> on|off", strlen("Usage: pieces <name> on|off"));
+        Warn("Invalid arguments for pieces");
+        return 0;
+    }
+
+    int on = strcmp(mode, "on") == 0;
+    if (cmd_pieces(name, on) == E_SUCCESS)
+    {
+        reply_with_yes(wb, NULL, 0);
+        Log("Pieces success: %s %s", name, mode);
+    }
+    else
+    {
+        reply_with_no(wb, "Failed to change piece-table mode", strlen("Failed to change piece-table mode"));
+        Warn("Failed to change piece-table mode: %s", name);
+    }
+
+    return 0;
+}
+
 int handle_e(tcp_buffer *wb, char *args, int len)
 {
     const char *msg = "Bye!";
@@ -389,6 +583,38 @@ int handle_pwd(tcp_buffer *wb, char *args, int len)
     return 0;
 }
 
+int handle_cachestat(tcp_buffer *wb, char *args, int len)
+{
+    char out[1024];
+    if (cmd_cachestat(out, sizeof(out)) == E_SUCCESS)
+    {
+        reply_with_yes(wb, out, strlen(out));
+    }
+    else
+    {
+        reply_with_no(wb, "Permission denied", strlen("Permission denied"));
+        Warn("Cache statistics denied for non-admin user");
+    }
+    return 0;
+}
+
+int handle_allocstat(tcp_buffer *wb, char *args, int len)
+{
+    char out[1024];
+    if (cmd_allocstat(out, sizeof(out)) == E_SUCCESS)
+    {
+        reply_with_yes(wb, out, strlen(out));
+    }
+    else
+    {
+        reply_with_no(wb, "Permission denied", strlen("Permission denied"));
+        Warn("Allocator statistics denied for non-admin user");
+    }
+    return 0;
+}
+
+int handle_sync(tcp_buffer *wb, char *args, int len);
+
 static struct
 {
     const char *name;
@@ -402,16 +628,56 @@ static struct
     {"rmdir", handle_rmdir},
     {"ls", handle_ls},
     {"cat", handle_cat},
+    {"read", handle_read_range},
     {"w", handle_w},
     {"i", handle_i},
     {"d", handle_d},
+    {"pwrite", handle_pwrite},
+    {"append", handle_append},
+    {"fallocate", handle_fallocate},
+    {"pieces", handle_pieces},
     {"e", handle_e},
     {"login", handle_login},
     {"adduser", handle_adduser},
-    {"pwd", handle_pwd}};
+    {"pwd", handle_pwd},
+    {"sync", handle_sync},
+    {"cachestat", handle_cachestat},
+    {"allocstat", handle_allocstat}};
 
 #define NCMD (sizeof(cmd_table) / sizeof(cmd_table[0]))
 
+// 解析并执行一条命令, 返回处理函数的返回值 (1 表示未知命令)
+static int dispatch(tcp_buffer *wb, char *msg, int len)
+{
+    char *p = strtok(msg, " ");
+    int ret = 1;
+    for (int i = 0; i < NCMD; i++)
+        if (p && strcmp(p, cmd_table[i].name) == 0)
+        {
+            ret = cmd_table[i].handler(wb, p + strlen(p) + 1, len - strlen(p) - 1);
+            break;
+        }
+    return ret;
+}
+
+// sync          - 立即写回所有脏块
+// sync <cmd...> - 执行命令并在回复前同步写回
+int handle_sync(tcp_buffer *wb, char *args, int len)
+{
+    if (len <= 0 || args[0] == '\0')
+    {
+        fs_sync();
+        reply_with_yes(wb, NULL, 0);
+        Log("Sync success");
+        return 0;
+    }
+
+    fs_set_sync(1);
+    int ret = dispatch(wb, args, len);
+    fs_set_sync(0);
+    return ret;
+}
+
 void on_connection(int id)
 {
     init_connection(id);
@@ -429,14 +695,9 @@ int on_recv(int id, tcp_buffer *wb, char *msg, int len)
     if (newline)
         *newline = '\0';
 
-    char *p = strtok(msg, " ");
-    int ret = 1;
-    for (int i = 0; i < NCMD; i++)
-        if (p && strcmp(p, cmd_table[i].name) == 0)
-        {
-            ret = cmd_table[i].handler(wb, p + strlen(p) + 1, len - strlen(p) - 1);
-            break;
-        }
+    fs_lock(); // 后台线程只在两条命令之间修改文件系统
+    int ret = dispatch(wb, msg, len);
+    fs_unlock();
     if (ret == 1)
     {
         static char unk[] = "Unknown command";
@@ -457,6 +718,23 @@ void cleanup(int id)
 
 FILE *log_file;
 
+// 信号线程: 收到 SIGINT/SIGTERM 时先写回脏块再退出
+static void *signal_main(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    int sig;
+    sigwait(set, &sig);
+    Log("Received signal %d, flushing cache before exit", sig);
+    reclaim_stop(); // 没回收完的孤儿留在孤儿表中, 下次启动继续
+    fs_lock();      // 等正在执行的命令结束; 不再释放, 之后的命令不会开始
+    cache_stop_writeback();
+    fs_sync();
+    cache_save_manifest();
+    cleanup_disk_connection();
+    exit(EXIT_SUCCESS);
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2)
@@ -483,6 +761,35 @@ int main(int argc, char *argv[])
     get_disk_info(&ncyl, &nsec);
     sbinit(ncyl, nsec);
 
+    // 按上次保存的热块清单预热缓存, 完成后才开始接受客户端
+    cache_set_manifest(CACHE_MANIFEST_FILE);
+    cache_warm_start();
+
+    // 在创建其他线程前屏蔽退出信号, 统一由信号线程处理
+    static sigset_t exit_signals;
+    sigemptyset(&exit_signals);
+    sigaddset(&exit_signals, SIGINT);
+    sigaddset(&exit_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &exit_signals, NULL);
+    pthread_t signal_thread;
+    pthread_create(&signal_thread, NULL, signal_main, &exit_signals);
+
+    // 启动后台写回线程, 写命令不再同步刷盘
+    if (cache_start_writeback() < 0)
+    {
+        Warn("Failed to start cache writeback thread, falling back to synchronous flush");
+    }
+    else
+    {
+        delalloc_set(1); // 有写回线程时新数据的物理块推迟到写回时分配
+    }
+
+    // 启动后台回收线程, 删除大文件时不再同步释放数据块
+    if (reclaim_start() < 0)
+    {
+        Warn("Failed to start reclaim thread, deleted files are reclaimed synchronously");
+    }
+
     Log("File system server starting on port %d, connected to disk server on port %d", fs_port, disk_port);
 
     // 启动TCP服务器
@@ -490,6 +797,7 @@ int main(int argc, char *argv[])
     server_run(server);
 
     // never reached
+    cache_stop_writeback();
     cleanup_disk_connection();
     log_close();
 }
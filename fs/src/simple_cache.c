@@ -1,44 +1,174 @@
 #include "simple_cache.h"
 #include "log.h"
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
 
 // 声明原始的磁盘操作函数
 extern void raw_read_block(int blockno, uchar *buf);
 extern void raw_write_block(int blockno, uchar *buf);
 
 // 全局块缓存数组
-static block_cache_entry_t block_cache[BLOCK_CACHE_SIZE];
+static block_cache_entry_t *block_cache = NULL;
+static int cache_slots = 0; // 缓存槽位数
 static int cache_initialized = 0;
-static int next_slot = 0;  // 简单的轮询指针
+// 元数据和文件数据各有一条 LRU 链表, 下标为 BC_IS_META(cls)
+static int lru_head[2] = {-1, -1}; // 链表头 (最近使用, 热端)
+static int lru_tail[2] = {-1, -1}; // 链表尾 (最久未用, 冷端, 优先替换)
+static int meta_count = 0;         // 元数据块占用的槽位数
+static int meta_budget = 0;        // 元数据最多占用的槽位数
+static int dirty_count = 0; // 当前脏块数量
+static int dirty_head = -1; // 脏链表头 (最早变脏)
+static int dirty_tail = -1; // 脏链表尾 (最近变脏)
+static int *hash_heads = NULL; // 块号哈希表, 按 hash_next 串成链
+static int hash_mask = 0;
+static int valid_count = 0; // 有效槽位数量
+static int free_hint = 0;   // 查找空闲槽位的起点
+static int writeback_inflight = 0; // 正在写回的块数量
+static cache_writeback_stats_t wb_stats; // 写回统计
+static cache_stats_t stats;              // 命中统计
+
+// 缓存锁: 保护 block_cache 及上面的计数器
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writeback_cond = PTHREAD_COND_INITIALIZER; // 唤醒写回线程
+static pthread_cond_t slot_done = PTHREAD_COND_INITIALIZER;      // 一批写回或一个块的加载完成
+
+// 写回线程状态
+static pthread_t writeback_thread;
+static int writeback_running = 0;
+
+// 热块清单文件路径 (为空表示不保存)
+static char manifest_path[256] = "";
+static void (*writeback_hook)(void) = NULL; // 上层在每个写回周期把到期的数据交给缓存
+
+// 获取单调时钟的毫秒数
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
 
 // 初始化块缓存
 void cache_init(void)
 {
-    if (cache_initialized)
+    if (!cache_initialized)
     {
-        return;
+        cache_init_size(BLOCK_CACHE_SIZE);
     }
+}
 
-    // 清空缓存
-    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+// 以 nslots 个槽位(重新)初始化块缓存, 原有内容(包括脏块)全部丢弃
+// 调用前需先 cache_flush 且不能有写回线程在运行
+int cache_init_size(int nslots)
+{
+    if (nslots <= 0)
     {
-        block_cache[i].blockno = 0;
-        block_cache[i].valid = 0;
-        block_cache[i].dirty = 0;
-        memset(block_cache[i].data, 0, BSIZE);
+        Error("cache_init_size: invalid slot count %d", nslots);
+        return -1;
+    }
+    int nbuckets = 1;
+    while (nbuckets < nslots)
+        nbuckets <<= 1;
+    block_cache_entry_t *slots = calloc(nslots, sizeof(block_cache_entry_t));
+    int *heads = malloc(nbuckets * sizeof(int));
+    if (!slots || !heads)
+    {
+        Error("cache_init_size: failed to allocate %d slots", nslots);
+        free(slots);
+        free(heads);
+        return -1;
+    }
+    for (int i = 0; i < nslots; i++)
+    {
+        slots[i].dirty_prev = -1;
+        slots[i].dirty_next = -1;
+        slots[i].hash_next = -1;
+        slots[i].lru_prev = -1;
+        slots[i].lru_next = -1;
+    }
+    for (int i = 0; i < nbuckets; i++)
+    {
+        heads[i] = -1;
     }
 
-    next_slot = 0;
+    pthread_mutex_lock(&cache_lock);
+    free(block_cache);
+    free(hash_heads);
+    block_cache = slots;
+    cache_slots = nslots;
+    hash_heads = heads;
+    hash_mask = nbuckets - 1;
+    valid_count = 0;
+    free_hint = 0;
+    lru_head[0] = lru_head[1] = -1;
+    lru_tail[0] = lru_tail[1] = -1;
+    meta_count = 0;
+    meta_budget = nslots - max(1, nslots * CACHE_DATA_RESERVE_PCT / 100);
+    dirty_count = 0;
+    dirty_head = dirty_tail = -1;
+    writeback_inflight = 0;
     cache_initialized = 1;
-    Log("Block cache initialized with %d slots", BLOCK_CACHE_SIZE);
+    pthread_mutex_unlock(&cache_lock);
+    Log("Block cache initialized with %d slots", nslots);
+    return 0;
+}
+
+// 标记槽位为脏并挂到脏链表尾部 (调用者持有 cache_lock)
+// 链表按变脏时间排序, 写回和统计只需遍历脏块
+static void mark_dirty(int slot)
+{
+    block_cache_entry_t *e = &block_cache[slot];
+    if (!e->dirty)
+    {
+        e->dirty = 1;
+        e->dirty_since = now_ms();
+        e->dirty_prev = dirty_tail;
+        e->dirty_next = -1;
+        if (dirty_tail >= 0)
+            block_cache[dirty_tail].dirty_next = slot;
+        else
+            dirty_head = slot;
+        dirty_tail = slot;
+        dirty_count++;
+    }
+}
+
+// 清除槽位的脏标记并从脏链表摘除 (调用者持有 cache_lock)
+static void clear_dirty(int slot)
+{
+    block_cache_entry_t *e = &block_cache[slot];
+    if (e->dirty)
+    {
+        if (e->dirty_prev >= 0)
+            block_cache[e->dirty_prev].dirty_next = e->dirty_next;
+        else
+            dirty_head = e->dirty_next;
+        if (e->dirty_next >= 0)
+            block_cache[e->dirty_next].dirty_prev = e->dirty_prev;
+        else
+            dirty_tail = e->dirty_prev;
+        e->dirty_prev = e->dirty_next = -1;
+        e->dirty = 0;
+        dirty_count--;
+    }
+}
+
+// 脏块是否超过了比例阈值 (调用者持有 cache_lock)
+static int over_dirty_ratio(void)
+{
+    return dirty_count * 100 > CACHE_DIRTY_RATIO * cache_slots;
 }
 
 // 在缓存中查找块
 static int find_block_in_cache(uint blockno)
 {
-    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    for (int i = hash_heads[blockno & hash_mask]; i >= 0; i = block_cache[i].hash_next)
     {
-        if (block_cache[i].valid && block_cache[i].blockno == blockno)
+        if (block_cache[i].blockno == blockno)
         {
             return i;
         }
@@ -46,36 +176,173 @@ static int find_block_in_cache(uint blockno)
     return -1; // 未找到
 }
 
-// 获取空闲的缓存槽位（简单轮询）
-static int get_free_cache_slot(void)
+// 槽位所在的分区: 1 为元数据, 0 为文件数据
+#define PART(slot) BC_IS_META(block_cache[slot].cls)
+
+// 从 LRU 链表摘除 (调用者持有 cache_lock)
+static void lru_unlink(int slot)
+{
+    block_cache_entry_t *e = &block_cache[slot];
+    int p = PART(slot);
+    if (e->lru_prev >= 0)
+        block_cache[e->lru_prev].lru_next = e->lru_next;
+    else
+        lru_head[p] = e->lru_next;
+    if (e->lru_next >= 0)
+        block_cache[e->lru_next].lru_prev = e->lru_prev;
+    else
+        lru_tail[p] = e->lru_prev;
+    e->lru_prev = e->lru_next = -1;
+}
+
+// 插入所属分区的 LRU 链表: hot 为 1 时放在热端, 否则放在冷端 (调用者持有 cache_lock)
+static void lru_insert(int slot, int hot)
 {
-    // 先查找无效的槽位
-    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    block_cache_entry_t *e = &block_cache[slot];
+    int p = PART(slot);
+    if (hot)
     {
-        if (!block_cache[i].valid)
+        e->lru_prev = -1;
+        e->lru_next = lru_head[p];
+        if (lru_head[p] >= 0)
+            block_cache[lru_head[p]].lru_prev = slot;
+        else
+            lru_tail[p] = slot;
+        lru_head[p] = slot;
+    }
+    else
+    {
+        e->lru_next = -1;
+        e->lru_prev = lru_tail[p];
+        if (lru_tail[p] >= 0)
+            block_cache[lru_tail[p]].lru_next = slot;
+        else
+            lru_head[p] = slot;
+        lru_tail[p] = slot;
+    }
+}
+
+// 标记槽位被访问, 移到热端 (调用者持有 cache_lock)
+static void lru_touch(int slot)
+{
+    if (slot != lru_head[PART(slot)])
+    {
+        lru_unlink(slot);
+        lru_insert(slot, 1);
+    }
+}
+
+// 更新槽位的块类别, 跨分区时移到新分区 (调用者持有 cache_lock)
+static void set_class(int slot, int cls)
+{
+    block_cache_entry_t *e = &block_cache[slot];
+    if (e->cls == cls)
+        return;
+    if (BC_IS_META(e->cls) == BC_IS_META(cls))
+    {
+        e->cls = cls;
+        return;
+    }
+    lru_unlink(slot);
+    meta_count += BC_IS_META(cls) ? 1 : -1;
+    e->cls = cls;
+    lru_insert(slot, 1);
+}
+
+// 让槽位生效并加入哈希表和 LRU 链表 (调用者持有 cache_lock)
+static void install_slot(int slot, uint blockno, int cls, int hot)
+{
+    block_cache_entry_t *e = &block_cache[slot];
+    e->blockno = blockno;
+    e->cls = cls;
+    e->valid = 1;
+    e->hash_next = hash_heads[blockno & hash_mask];
+    hash_heads[blockno & hash_mask] = slot;
+    lru_insert(slot, hot);
+    valid_count++;
+    if (BC_IS_META(cls))
+        meta_count++;
+}
+
+// 使槽位失效并移出哈希表和 LRU 链表 (调用者持有 cache_lock)
+static void evict_slot(int slot)
+{
+    block_cache_entry_t *e = &block_cache[slot];
+    int *pp = &hash_heads[e->blockno & hash_mask];
+    while (*pp != slot)
+        pp = &block_cache[*pp].hash_next;
+    *pp = e->hash_next;
+    e->hash_next = -1;
+    lru_unlink(slot);
+    e->valid = 0;
+    valid_count--;
+    if (BC_IS_META(e->cls))
+        meta_count--;
+}
+
+// 分区冷端第一个可替换的槽位 (跳过正在写回或加载的槽位), 没有则返回 -1
+static int lru_victim(int part)
+{
+    int slot = lru_tail[part];
+    while (slot >= 0 && (block_cache[slot].writeback || block_cache[slot].loading))
+        slot = block_cache[slot].lru_prev;
+    return slot;
+}
+
+// 为 cls 类的块获取缓存槽位
+// 元数据最多占用 meta_budget 个槽位, 其余留给文件数据; 文件数据不会替换元数据,
+// 找不到可替换的数据块时返回 -1, 调用者直接访问磁盘 (绕过缓存)
+static int get_free_cache_slot(int cls)
+{
+    int meta = BC_IS_META(cls);
+    int slot;
+
+    if (meta && meta_count >= meta_budget)
+    {
+        // 元数据已用满预算, 只替换元数据
+        while ((slot = lru_victim(1)) < 0)
+            pthread_cond_wait(&slot_done, &cache_lock);
+    }
+    else
+    {
+        // 先查找无效的槽位
+        for (; valid_count < cache_slots; free_hint = (free_hint + 1) % cache_slots)
         {
-            return i;
+            if (!block_cache[free_hint].valid)
+            {
+                return free_hint;
+            }
+        }
+
+        // 所有槽位都被占用, 优先替换文件数据
+        for (;;)
+        {
+            slot = lru_victim(0);
+            if (slot < 0 && meta)
+                slot = lru_victim(1);
+            if (slot >= 0)
+                break;
+            if (!meta)
+                return -1;
+            pthread_cond_wait(&slot_done, &cache_lock); // 全部在写回或加载, 等待其完成
         }
     }
 
-    // 所有槽位都被占用，使用轮询替换
-    int slot = next_slot;
-    next_slot = (next_slot + 1) % BLOCK_CACHE_SIZE;
-    
     // 如果被替换的块是脏的，先写回磁盘
     if (block_cache[slot].dirty)
     {
         raw_write_block(block_cache[slot].blockno, block_cache[slot].data);
-        block_cache[slot].dirty = 0;
+        clear_dirty(slot);
     }
-    
+
     // 清空槽位
-    block_cache[slot].valid = 0;
+    evict_slot(slot);
     return slot;
 }
 
-// 缓存版本的读块
-void cached_read_block(int blockno, uchar *buf)
+// 读块; stream 为 1 表示顺序扫描的数据块: 未命中时放在冷端, 命中 (通常是预读的块)
+// 时降到冷端, 用过一次即可被替换, 避免一次大文件扫描把热块挤出缓存
+static void cache_read(int blockno, uchar *buf, int cls, int stream)
 {
 #if CACHE_DISABLED
     raw_read_block(blockno, buf);
@@ -87,28 +354,197 @@ void cached_read_block(int blockno, uchar *buf)
         cache_init();
     }
 
-    // 在缓存中查找
-    int slot = find_block_in_cache(blockno);
-    if (slot >= 0)
+    pthread_mutex_lock(&cache_lock);
+    if (stream)
+        stats.stream_reads++;
+    int waited = 0;
+    for (;;)
     {
-        // 缓存命中
-        memcpy(buf, block_cache[slot].data, BSIZE);
+        // 在缓存中查找
+        int slot = find_block_in_cache(blockno);
+        if (slot >= 0 && block_cache[slot].loading)
+        {
+            // 其他线程正在从磁盘读取该块, 等它读完而不是重复读盘
+            if (!waited++)
+                stats.coalesced++;
+            pthread_cond_wait(&slot_done, &cache_lock);
+            continue;
+        }
+        if (slot >= 0)
+        {
+            // 缓存命中
+            stats.hits++;
+            stats.class_hits[cls]++;
+            set_class(slot, cls);
+            if (stream)
+            {
+                lru_unlink(slot);
+                lru_insert(slot, 0);
+            }
+            else
+            {
+                lru_touch(slot);
+            }
+            memcpy(buf, block_cache[slot].data, BSIZE);
+            pthread_mutex_unlock(&cache_lock);
+            return;
+        }
+
+        // 缓存未命中 - 先占好槽位 (等待空闲槽位时可能已被其他线程装入)
+        slot = get_free_cache_slot(cls);
+        if (slot >= 0 && find_block_in_cache(blockno) >= 0)
+            continue;
+        stats.misses++;
+        stats.class_misses[cls]++;
+        if (slot < 0)
+        {
+            stats.bypass++;
+            pthread_mutex_unlock(&cache_lock);
+            raw_read_block(blockno, buf);
+            return;
+        }
+
+        // 槽位标记为加载中后释放锁读盘, 同一块的其他请求在槽位上等待
+        install_slot(slot, blockno, cls, !stream);
+        block_cache[slot].loading = 1;
+        pthread_mutex_unlock(&cache_lock);
+        raw_read_block(blockno, buf);
+        pthread_mutex_lock(&cache_lock);
+        memcpy(block_cache[slot].data, buf, BSIZE);
+        block_cache[slot].loading = 0;
+        pthread_cond_broadcast(&slot_done);
+        pthread_mutex_unlock(&cache_lock);
         return;
     }
+}
 
-    // 缓存未命中 - 从磁盘读取
-    raw_read_block(blockno, buf);
+// 块是否在缓存中 (包括正在加载的块)
+int cache_contains(int blockno)
+{
+    if (!cache_initialized)
+        return 0;
+    pthread_mutex_lock(&cache_lock);
+    int found = find_block_in_cache(blockno) >= 0;
+    pthread_mutex_unlock(&cache_lock);
+    return found;
+}
 
-    // 将块添加到缓存
-    slot = get_free_cache_slot();
-    block_cache[slot].blockno = blockno;
-    memcpy(block_cache[slot].data, buf, BSIZE);
-    block_cache[slot].valid = 1;
-    block_cache[slot].dirty = 0;
+// 丢弃块在缓存中的副本 (块已被释放): 脏数据不再写回, 槽位直接空出
+void cache_discard(int blockno)
+{
+#if CACHE_DISABLED
+    return;
+#endif
+    if (!cache_initialized)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    for (;;)
+    {
+        int slot = find_block_in_cache(blockno);
+        if (slot < 0)
+            break;
+        if (block_cache[slot].loading || block_cache[slot].writeback)
+        {
+            pthread_cond_wait(&slot_done, &cache_lock); // 等待读盘或写回完成
+            continue;
+        }
+        if (block_cache[slot].dirty)
+        {
+            clear_dirty(slot);
+            stats.discarded_dirty++;
+        }
+        evict_slot(slot);
+        stats.discarded++;
+        break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// 比较两个槽位的块号
+static int slot_blockno_cmp(const void *a, const void *b)
+{
+    uint x = block_cache[*(const int *)a].blockno, y = block_cache[*(const int *)b].blockno;
+    return x < y ? -1 : x > y;
+}
+
+// 预取一组块: 不在缓存中的块先占好槽位 (标记为加载中), 按块号排序后
+// 连续的块合并为一次多块读. 预取的块放在热端, 被顺序读取消费后降到冷端
+void cache_prefetch(const uint *blocks, int n, int cls)
+{
+#if CACHE_DISABLED
+    return;
+#endif
+    if (n <= 0)
+        return;
+    if (!cache_initialized)
+        cache_init();
+
+    int *slots = malloc(n * sizeof(int));
+    if (!slots)
+        return;
+    int m = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < n; i++)
+    {
+        if (find_block_in_cache(blocks[i]) >= 0)
+            continue;
+        int slot = get_free_cache_slot(cls);
+        if (slot < 0)
+            break; // 没有可替换的槽位, 放弃剩余的预取
+        if (find_block_in_cache(blocks[i]) >= 0)
+            continue;
+        install_slot(slot, blocks[i], cls, 1);
+        block_cache[slot].loading = 1;
+        slots[m++] = slot;
+    }
+    stats.prefetched += m;
+    pthread_mutex_unlock(&cache_lock);
+
+    // 加载中的槽位不会被替换, 可以在锁外访问其块号和数据
+    qsort(slots, m, sizeof(int), slot_blockno_cmp);
+    uchar run[MAX_IO_BLOCKS * BSIZE];
+    for (int i = 0; i < m;)
+    {
+        int j = i + 1;
+        while (j < m && j - i < MAX_IO_BLOCKS && block_cache[slots[j]].blockno == block_cache[slots[j - 1]].blockno + 1)
+            j++;
+        if (j - i > 1 && raw_read_blocks(block_cache[slots[i]].blockno, j - i, run) == 0)
+        {
+            for (int k = i; k < j; k++)
+                memcpy(block_cache[slots[k]].data, run + (k - i) * BSIZE, BSIZE);
+        }
+        else
+        {
+            for (int k = i; k < j; k++)
+                raw_read_block(block_cache[slots[k]].blockno, block_cache[slots[k]].data);
+        }
+        i = j;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < m; i++)
+    {
+        block_cache[slots[i]].loading = 0;
+    }
+    pthread_cond_broadcast(&slot_done);
+    pthread_mutex_unlock(&cache_lock);
+    free(slots);
+}
+
+// 缓存版本的读块
+void cached_read_block(int blockno, uchar *buf, int cls)
+{
+    cache_read(blockno, buf, cls, 0);
+}
+
+// 缓存版本的读块 (顺序扫描的文件数据)
+void cached_read_block_stream(int blockno, uchar *buf)
+{
+    cache_read(blockno, buf, BC_DATA, 1);
 }
 
 // 缓存版本的写块
-void cached_write_block(int blockno, uchar *buf)
+void cached_write_block(int blockno, uchar *buf, int cls)
 {
 #if CACHE_DISABLED
     raw_write_block(blockno, buf);
@@ -120,22 +556,185 @@ void cached_write_block(int blockno, uchar *buf)
         cache_init();
     }
 
-    // 在缓存中查找
-    int slot = find_block_in_cache(blockno);
-    if (slot >= 0)
+    pthread_mutex_lock(&cache_lock);
+    int slot;
+    for (;;)
     {
-        // 缓存命中 - 更新缓存数据
-        memcpy(block_cache[slot].data, buf, BSIZE);
-        block_cache[slot].dirty = 1;  // 标记为脏
-        return;
+        // 在缓存中查找
+        slot = find_block_in_cache(blockno);
+        if (slot >= 0 && block_cache[slot].loading)
+        {
+            // 等待正在进行的读盘完成, 否则读到的旧数据会覆盖这次写入
+            pthread_cond_wait(&slot_done, &cache_lock);
+            continue;
+        }
+        if (slot >= 0)
+        {
+            set_class(slot, cls);
+            lru_touch(slot);
+            break;
+        }
+
+        // 缓存未命中 - 添加到缓存
+        slot = get_free_cache_slot(cls);
+        if (slot >= 0 && find_block_in_cache(blockno) >= 0)
+            continue;
+        if (slot < 0)
+        {
+            // 没有可替换的数据块, 直接写穿到磁盘
+            stats.bypass++;
+            raw_write_block(blockno, buf);
+            pthread_mutex_unlock(&cache_lock);
+            return;
+        }
+        install_slot(slot, blockno, cls, 1);
+        break;
     }
 
-    // 缓存未命中 - 添加到缓存并标记为脏
-    slot = get_free_cache_slot();
-    block_cache[slot].blockno = blockno;
+    // 更新缓存数据并标记为脏
     memcpy(block_cache[slot].data, buf, BSIZE);
-    block_cache[slot].valid = 1;
-    block_cache[slot].dirty = 1;
+    mark_dirty(slot);
+
+    // 脏块过多时唤醒写回线程, 不在当前请求中同步写回
+    if (writeback_running && over_dirty_ratio())
+    {
+        pthread_cond_signal(&writeback_cond);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// 写入连续的多个块: 禁用缓存时直接合并为多块写, 否则逐块放入缓存, 写回时再按物理位置合并
+void cached_write_blocks(int blockno, int nblocks, uchar *buf, int cls)
+{
+#if CACHE_DISABLED
+    for (int i = 0; i < nblocks; i += MAX_IO_BLOCKS)
+        raw_write_blocks(blockno + i, min(MAX_IO_BLOCKS, nblocks - i), buf + i * BSIZE);
+    return;
+#endif
+    for (int i = 0; i < nblocks; i++)
+        cached_write_block(blockno + i, buf + i * BSIZE, cls);
+}
+
+// 待写回的脏块
+typedef struct
+{
+    int slot;     // 缓存槽位
+    uint blockno; // 块号
+    int cyl;      // 柱面
+    int sec;      // 扇区
+} wb_item;
+
+// 按 (柱面, 扇区) 排序
+static int wb_item_cmp(const void *a, const void *b)
+{
+    const wb_item *x = a, *y = b;
+    if (x->cyl != y->cyl)
+        return x->cyl < y->cyl ? -1 : 1;
+    if (x->sec != y->sec)
+        return x->sec < y->sec ? -1 : 1;
+    return 0;
+}
+
+// 从 head 所在柱面出发依次访问 items 的模拟寻道距离
+static long seek_distance(const wb_item *items, int n, int head)
+{
+    long dist = 0;
+    for (int i = 0; i < n; i++)
+    {
+        dist += labs((long)items[i].cyl - head);
+        head = items[i].cyl;
+    }
+    return dist;
+}
+
+// 写回一批脏块, 返回写回的块数
+// expire_before >= 0 时只写回在该时间之前变脏的块
+// 脏块按柱面排序后从磁头位置单向扫描 (C-LOOK), 相邻块合并为一次多块写
+static int writeback_batch(long expire_before)
+{
+    wb_item items[CACHE_WRITEBACK_BATCH];
+    wb_item sorted[CACHE_WRITEBACK_BATCH];
+    static uchar data[CACHE_WRITEBACK_BATCH][BSIZE]; // 只由持有 batch_lock 的线程使用
+    static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+    int n = 0;
+
+    pthread_mutex_lock(&batch_lock);
+    pthread_mutex_lock(&cache_lock);
+    // 脏链表按变脏时间排序, 遇到未过期的块即可停止
+    for (int i = dirty_head; i >= 0 && n < CACHE_WRITEBACK_BATCH; i = block_cache[i].dirty_next)
+    {
+        block_cache_entry_t *e = &block_cache[i];
+        if (expire_before >= 0 && e->dirty_since > expire_before)
+            break;
+        if (e->writeback) // 写回期间又被写脏, 等这一轮完成后再写
+            continue;
+        items[n].slot = i;
+        items[n].blockno = e->blockno;
+        block_to_cyl_sec(e->blockno, &items[n].cyl, &items[n].sec);
+        n++;
+    }
+    if (n == 0)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        pthread_mutex_unlock(&batch_lock);
+        return 0;
+    }
+
+    int head = disk_head_cyl();
+    long unsorted_dist = seek_distance(items, n, head);
+
+    // 排序后从第一个不小于磁头柱面的块开始扫描, 扫到末尾再回到最小柱面
+    qsort(items, n, sizeof(wb_item), wb_item_cmp);
+    int start = 0;
+    while (start < n && items[start].cyl < head)
+        start++;
+    for (int i = 0; i < n; i++)
+    {
+        sorted[i] = items[(start + i) % n];
+    }
+
+    // 拷贝一份快照后即可释放锁, 写回期间的新写入会重新标脏
+    for (int i = 0; i < n; i++)
+    {
+        block_cache_entry_t *e = &block_cache[sorted[i].slot];
+        memcpy(data[i], e->data, BSIZE);
+        e->writeback = 1;
+        clear_dirty(sorted[i].slot);
+    }
+    writeback_inflight += n;
+    pthread_mutex_unlock(&cache_lock);
+
+    // 合并连续块, 每段一次磁盘请求
+    int requests = 0;
+    for (int i = 0; i < n;)
+    {
+        int j = i + 1;
+        while (j < n && j - i < MAX_IO_BLOCKS && sorted[j].blockno == sorted[j - 1].blockno + 1)
+            j++;
+        raw_write_blocks(sorted[i].blockno, j - i, data[i]);
+        requests++;
+        i = j;
+    }
+    long sorted_dist = seek_distance(sorted, n, head);
+
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < n; i++)
+    {
+        block_cache[sorted[i].slot].writeback = 0;
+    }
+    writeback_inflight -= n;
+    wb_stats.flushes++;
+    wb_stats.blocks += n;
+    wb_stats.requests += requests;
+    wb_stats.seek_distance += sorted_dist;
+    wb_stats.seek_unsorted += unsorted_dist;
+    pthread_cond_broadcast(&slot_done);
+    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&batch_lock);
+
+    Log("cache writeback: %d blocks in %d requests, seek distance %ld cylinders (slot order: %ld)",
+        n, requests, sorted_dist, unsorted_dist);
+    return n;
 }
 
 // 刷新所有脏块到磁盘
@@ -149,12 +748,358 @@ void cache_flush(void)
         return;
     }
 
-    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    for (;;)
     {
-        if (block_cache[i].valid && block_cache[i].dirty)
+        while (writeback_batch(-1) > 0)
+            ;
+
+        // 等待写回线程手中的块落盘; 其间又被写脏的块需要再写一轮
+        pthread_mutex_lock(&cache_lock);
+        while (writeback_inflight > 0)
         {
-            raw_write_block(block_cache[i].blockno, block_cache[i].data);
-            block_cache[i].dirty = 0;
+            pthread_cond_wait(&slot_done, &cache_lock);
         }
+        int remaining = dirty_count;
+        pthread_mutex_unlock(&cache_lock);
+        if (remaining == 0)
+            break;
     }
-}
\ No newline at end of file
+}
+
+// 后台写回线程: 按脏块比例和驻留时间写回
+static void *writeback_main(void *arg)
+{
+    Log("cache writeback thread started (ratio=%d%%, expire=%dms)", CACHE_DIRTY_RATIO, CACHE_DIRTY_EXPIRE_MS);
+    long last_manifest = now_ms();
+    pthread_mutex_lock(&cache_lock);
+    while (writeback_running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CACHE_WRITEBACK_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (CACHE_WRITEBACK_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int rc = 0;
+        while (writeback_running && !over_dirty_ratio() && rc != ETIMEDOUT)
+        {
+            rc = pthread_cond_timedwait(&writeback_cond, &cache_lock, &deadline);
+        }
+        if (!writeback_running)
+            break;
+        pthread_mutex_unlock(&cache_lock);
+
+        if (writeback_hook)
+            writeback_hook();
+        int written = 0;
+        // 超过比例阈值: 写回到阈值以下
+        for (;;)
+        {
+            pthread_mutex_lock(&cache_lock);
+            int over = over_dirty_ratio();
+            pthread_mutex_unlock(&cache_lock);
+            if (!over)
+                break;
+            int n = writeback_batch(-1);
+            if (n == 0)
+                break;
+            written += n;
+        }
+        // 写回驻留过久的脏块
+        long expire_before = now_ms() - CACHE_DIRTY_EXPIRE_MS;
+        int n;
+        while ((n = writeback_batch(expire_before)) > 0)
+        {
+            written += n;
+        }
+        if (written > 0)
+        {
+            Log("cache writeback: wrote %d blocks", written);
+        }
+
+        // 定期保存热块清单
+        if (manifest_path[0] && now_ms() - last_manifest >= CACHE_MANIFEST_INTERVAL_MS)
+        {
+            last_manifest = now_ms();
+            cache_save_manifest();
+        }
+
+        pthread_mutex_lock(&cache_lock);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    Log("cache writeback thread stopped");
+    return NULL;
+}
+
+// 设置热块清单文件, 写回线程会定期保存
+void cache_set_manifest(const char *path)
+{
+    pthread_mutex_lock(&cache_lock);
+    snprintf(manifest_path, sizeof(manifest_path), "%s", path ? path : "");
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// 清单文件头
+typedef struct
+{
+    uint magic;
+    uint count;
+} manifest_header;
+
+// 清单项: 块号左移 4 位, 低 4 位为块类别
+#define MANIFEST_ENTRY(blockno, cls) (((uint)(blockno) << 4) | (uint)(cls))
+#define MANIFEST_BLOCKNO(e) ((e) >> 4)
+#define MANIFEST_CLASS(e) ((int)((e) & 0xf))
+
+// 把缓存中的块号按热度写入清单: 元数据在前, 每个分区从热端到冷端
+int cache_save_manifest(void)
+{
+    if (!cache_initialized || !manifest_path[0])
+        return -1;
+
+    uint *entries = malloc(cache_slots * sizeof(uint));
+    if (!entries)
+        return -1;
+    int n = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int p = 1; p >= 0; p--)
+    {
+        for (int i = lru_head[p]; i >= 0 && n < cache_slots; i = block_cache[i].lru_next)
+        {
+            entries[n++] = MANIFEST_ENTRY(block_cache[i].blockno, block_cache[i].cls);
+        }
+    }
+    char path[sizeof(manifest_path)], tmp[sizeof(manifest_path) + 8];
+    snprintf(path, sizeof(path), "%s", manifest_path);
+    pthread_mutex_unlock(&cache_lock);
+
+    // 先写临时文件再改名, 避免崩溃时留下半个清单
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp)
+    {
+        Warn("cache manifest: cannot open %s", tmp);
+        free(entries);
+        return -1;
+    }
+    manifest_header hdr = {CACHE_MANIFEST_MAGIC, n};
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(entries, sizeof(uint), n, fp) == (size_t)n;
+    ok = (fclose(fp) == 0) && ok;
+    free(entries);
+    if (!ok || rename(tmp, path) != 0)
+    {
+        Warn("cache manifest: failed to write %s", path);
+        remove(tmp);
+        return -1;
+    }
+    Log("cache manifest: saved %d blocks to %s", n, path);
+    return n;
+}
+
+// 比较清单项的块号 (块号顺序即柱面顺序)
+static int manifest_cmp(const void *a, const void *b)
+{
+    uint x = MANIFEST_BLOCKNO(*(const uint *)a), y = MANIFEST_BLOCKNO(*(const uint *)b);
+    return x < y ? -1 : x > y;
+}
+
+// 按清单预取热块: 块按柱面顺序合并为多块读, 再按热度从冷到热装入缓存,
+// 使最热的块位于 LRU 热端. 应在接受客户端请求之前调用. 返回装入的块数
+int cache_warm_start(void)
+{
+    if (!cache_initialized)
+        cache_init();
+    if (!manifest_path[0])
+        return 0;
+
+    FILE *fp = fopen(manifest_path, "rb");
+    if (!fp)
+    {
+        Log("cache warm start: no manifest at %s", manifest_path);
+        return 0;
+    }
+    long start = now_ms();
+    manifest_header hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != CACHE_MANIFEST_MAGIC)
+    {
+        Warn("cache warm start: invalid manifest %s", manifest_path);
+        fclose(fp);
+        return 0;
+    }
+    int n = min((int)hdr.count, cache_slots);
+    uint *entries = malloc((n + 1) * sizeof(uint));
+    uint *sorted = malloc((n + 1) * sizeof(uint));
+    uchar *data = malloc((size_t)(n + 1) * BSIZE);
+    if (!entries || !sorted || !data)
+    {
+        fclose(fp);
+        free(entries);
+        free(sorted);
+        free(data);
+        return 0;
+    }
+    n = fread(entries, sizeof(uint), n, fp);
+    fclose(fp);
+
+    // 按柱面顺序读取, 连续块合并为一次请求; 读失败的块不装入
+    memcpy(sorted, entries, n * sizeof(uint));
+    qsort(sorted, n, sizeof(uint), manifest_cmp);
+    int requests = 0, m = 0;
+    for (int i = 0; i < n;)
+    {
+        int j = i + 1;
+        while (j < n && j - i < MAX_IO_BLOCKS && MANIFEST_BLOCKNO(sorted[j]) == MANIFEST_BLOCKNO(sorted[j - 1]) + 1)
+            j++;
+        requests++;
+        if (raw_read_blocks(MANIFEST_BLOCKNO(sorted[i]), j - i, data + (size_t)m * BSIZE) == 0)
+        {
+            memmove(&sorted[m], &sorted[i], (j - i) * sizeof(uint));
+            m += j - i;
+        }
+        i = j;
+    }
+
+    // 从最冷的块开始装入, 每块都放在热端
+    int loaded = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = n - 1; i >= 0; i--)
+    {
+        uint *hit = bsearch(&entries[i], sorted, m, sizeof(uint), manifest_cmp);
+        uint blockno = MANIFEST_BLOCKNO(entries[i]);
+        int cls = MANIFEST_CLASS(entries[i]);
+        if (!hit || cls >= BC_NCLASS || find_block_in_cache(blockno) >= 0)
+            continue;
+        int slot = get_free_cache_slot(cls);
+        if (slot < 0)
+            continue;
+        install_slot(slot, blockno, cls, 1);
+        memcpy(block_cache[slot].data, data + (size_t)(hit - sorted) * BSIZE, BSIZE);
+        loaded++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    free(entries);
+    free(sorted);
+    free(data);
+    Log("cache warm start: loaded %d blocks in %d requests, %ld ms", loaded, requests, now_ms() - start);
+    return loaded;
+}
+
+// 启动后台写回线程
+int cache_start_writeback(void)
+{
+#if CACHE_DISABLED
+    return 0;
+#endif
+    if (!cache_initialized)
+    {
+        cache_init();
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if (writeback_running)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        return 0;
+    }
+    writeback_running = 1;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (pthread_create(&writeback_thread, NULL, writeback_main, NULL) != 0)
+    {
+        Error("cache_start_writeback: failed to create writeback thread");
+        pthread_mutex_lock(&cache_lock);
+        writeback_running = 0;
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+    return 0;
+}
+
+// 停止后台写回线程并刷新剩余脏块
+void cache_stop_writeback(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    if (!writeback_running)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+    writeback_running = 0;
+    pthread_cond_signal(&writeback_cond);
+    pthread_mutex_unlock(&cache_lock);
+
+    pthread_join(writeback_thread, NULL);
+    cache_flush();
+}
+
+void cache_set_writeback_hook(void (*hook)(void))
+{
+    writeback_hook = hook;
+}
+
+// 写回线程是否在运行
+int cache_writeback_active(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    int running = writeback_running;
+    pthread_mutex_unlock(&cache_lock);
+    return running;
+}
+
+// 获取命中统计
+void cache_get_stats(cache_stats_t *st)
+{
+    pthread_mutex_lock(&cache_lock);
+    *st = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// 格式化缓存统计信息, 返回写入的字节数
+int cache_format_stats(char *out, int size)
+{
+    cache_stats_t st;
+    cache_writeback_stats_t wb;
+    cache_get_stats(&st);
+    cache_get_writeback_stats(&wb);
+
+    pthread_mutex_lock(&cache_lock);
+    int used = valid_count, meta = meta_count, dirty = dirty_count;
+    pthread_mutex_unlock(&cache_lock);
+
+    int n = snprintf(out, size, "slots %d used %d meta %d/%d dirty %d bypass %ld\n",
+                     cache_slots, used, meta, meta_budget, dirty, st.bypass);
+    for (int c = 0; c < BC_NCLASS && n < size; c++)
+    {
+        long total = st.class_hits[c] + st.class_misses[c];
+        n += snprintf(out + n, size - n, "%-8s hits %ld misses %ld hit-rate %.1f%%\n", block_class_name(c),
+                      st.class_hits[c], st.class_misses[c], total ? 100.0 * st.class_hits[c] / total : 0.0);
+    }
+    if (n < size)
+        n += snprintf(out + n, size - n, "coalesced misses %ld prefetched %ld discarded %ld (dirty %ld)\n",
+                      st.coalesced, st.prefetched, st.discarded, st.discarded_dirty);
+    if (n < size)
+        n += snprintf(out + n, size - n, "writeback %ld blocks in %ld requests, seek %ld (slot order %ld)",
+                      wb.blocks, wb.requests, wb.seek_distance, wb.seek_unsorted);
+    return n < size ? n : size - 1;
+}
+
+// 获取写回统计
+void cache_get_writeback_stats(cache_writeback_stats_t *st)
+{
+    pthread_mutex_lock(&cache_lock);
+    *st = wb_stats;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// 当前脏块数量
+int cache_dirty_count(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    int n = dirty_count;
+    pthread_mutex_unlock(&cache_lock);
+    return n;
+}
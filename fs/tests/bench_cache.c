@@ -0,0 +1,119 @@
+// 块缓存微基准: 测量不同缓存大小下 cache_flush 的开销, 以及并发未命中时的读盘次数
+// 磁盘操作用空函数代替, 只统计缓存自身的开销
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "simple_cache.h"
+
+FILE *log_file;
+
+static long writes_issued = 0;
+static long reads_issued = 0;
+static int read_delay_us = 0; // 模拟的读盘延迟
+
+void raw_read_block(int blockno, uchar *buf)
+{
+    __sync_fetch_and_add(&reads_issued, 1);
+    if (read_delay_us)
+        usleep(read_delay_us);
+    memset(buf, 0, BSIZE);
+}
+void raw_write_block(int blockno, uchar *buf) { writes_issued++; }
+void raw_write_blocks(int blockno, int nblocks, uchar *buf) { writes_issued++; }
+int raw_read_blocks(int blockno, int nblocks, uchar *buf) { return -1; }
+void block_to_cyl_sec(int blockno, int *cyl, int *sec)
+{
+    *cyl = blockno / 63;
+    *sec = blockno % 63;
+}
+int disk_head_cyl(void) { return 0; }
+const char *block_class_name(int cls) { return "data"; }
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// 缓存填满后, 每轮写脏 ndirty 个块再 flush, 返回每次 flush 的平均微秒数
+static double bench_flush(int nslots, int ndirty, int rounds)
+{
+    uchar buf[BSIZE] = {0};
+    cache_init_size(nslots);
+    for (int i = 0; i < nslots; i++)
+    {
+        cached_read_block(i, buf, BC_DATA);
+    }
+
+    double total = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int k = 0; k < ndirty; k++)
+        {
+            cached_write_block((r * ndirty + k) % nslots, buf, BC_DATA);
+        }
+        double t0 = now_us();
+        cache_flush();
+        total += now_us() - t0;
+    }
+    return total / rounds;
+}
+
+// 多个线程同时读取同一组冷块, 模拟并发的 ls/cd
+#define STORM_THREADS 8
+#define STORM_BLOCKS 32
+
+static void *storm_main(void *arg)
+{
+    uchar buf[BSIZE];
+    for (int i = 0; i < STORM_BLOCKS; i++)
+    {
+        cached_read_block(1000000 + i, buf, BC_DIR);
+    }
+    return NULL;
+}
+
+static void bench_miss_storm(void)
+{
+    pthread_t threads[STORM_THREADS];
+    cache_init_size(BLOCK_CACHE_SIZE);
+    read_delay_us = 500;
+    reads_issued = 0;
+    for (int i = 0; i < STORM_THREADS; i++)
+        pthread_create(&threads[i], NULL, storm_main, NULL);
+    for (int i = 0; i < STORM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    read_delay_us = 0;
+
+    cache_stats_t st;
+    cache_get_stats(&st);
+    printf("\nmiss storm: %d threads x %d blocks, %ld disk reads, %ld coalesced waits\n", STORM_THREADS,
+           STORM_BLOCKS, reads_issued, st.coalesced);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    int sizes[] = {500, 2000, 8000, 32000, 128000};
+    int dirties[] = {1, 16};
+
+    log_init("/dev/null");
+    printf("%10s %8s %14s\n", "slots", "dirty", "flush (us)");
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+    {
+        for (int j = 0; j < (int)(sizeof(dirties) / sizeof(dirties[0])); j++)
+        {
+            double us = bench_flush(sizes[i], dirties[j], rounds);
+            printf("%10d %8d %14.2f\n", sizes[i], dirties[j], us);
+        }
+    }
+    bench_miss_storm();
+    log_close();
+    return 0;
+}
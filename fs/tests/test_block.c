@@ -6,6 +6,7 @@
 #include "fs.h"
 #include "bitmap.h"
 #include "log.h"
+#include "simple_cache.h"
 
 int nmeta;
 
@@ -34,7 +35,7 @@ int nmeta;
 void mock_format()
 {
     int size = 1024;
-    init_sb(size);         // 初始化超级块
+    init_sb(size, FS_DEFAULT_FEATURES); // 初始化超级块
     init_block_bitmap();   // 初始化数据块位图
     init_inode_system();   // 初始化inode位图和inode区域
     //init_root_directory(); // 初始化根目录
@@ -105,6 +106,7 @@ mt_test(test_allocate_block)
     }
 
     // check if the block is marked as used in the bitmap
+    bitmap_sync();
     read_block(BBLOCK(bno), buf);
     int i = bno % BPB;
     int m = 1 << (i % 8);
@@ -134,6 +136,7 @@ mt_test(test_free_block)
     free_block(bno);
 
     uchar buf[BSIZE];
+    bitmap_sync();
     read_block(BBLOCK(bno), buf);
 
     int i = bno % BPB;
@@ -142,6 +145,173 @@ mt_test(test_free_block)
     return 0;
 }
 
+mt_test(test_free_without_zero_fill)
+{
+    mock_format();
+    uchar buf[BSIZE];
+    uint bno = allocate_block_uninit();
+    mt_assert(bno != 0 && block_uninit(bno));
+
+    // 还没写过的块读出来是全零
+    read_block(bno, buf);
+    mt_assert(buf[0] == 0 && buf[BSIZE - 1] == 0);
+
+    // 写入后成为普通块; 释放时不写零, 脏副本直接丢弃
+    memset(buf, 's', BSIZE);
+    write_block(bno, buf);
+    mt_assert(!block_uninit(bno));
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    int dirty = cache_dirty_count();
+    free_block(bno);
+    cache_get_stats(&after);
+    mt_assert(!block_cached(bno));
+    mt_assert(cache_dirty_count() == dirty - 1);
+    mt_assert(after.discarded_dirty - before.discarded_dirty == 1);
+
+    // 重新分配到同一块时, 旧内容不会暴露
+    uint again = allocate_block_near(bno);
+    mt_assert(again == bno);
+    read_block(again, buf);
+    mt_assert(buf[0] == 0 && buf[BSIZE - 1] == 0);
+
+    // 未初始化标记不写盘, 不会马上写入的块要真正清零, 绕过标记读到的也是全零
+    zero_blocks(again, 1);
+    mt_assert(!block_uninit(again));
+    memset(buf, 's', BSIZE);
+    cached_read_block(again, buf, BC_DATA);
+    mt_assert(buf[0] == 0 && buf[BSIZE - 1] == 0);
+    return 0;
+}
+
+mt_test(test_bitmap_nearly_full)
+{
+    mock_format();
+    int nfree = bitmap_free_count(BITMAP_BLOCK);
+    mt_assert(nfree == sb.size - nmeta);
+    for (int i = 0; i < nfree; i++)
+    {
+        mt_assert(allocate_block_uninit() != 0);
+    }
+    mt_assert(bitmap_free_count(BITMAP_BLOCK) == 0);
+
+    // 磁盘几乎全满时分配只查内存中的位图, 不读位图块
+    uint holes[3] = {nmeta + 5, sb.size / 2, sb.size - 1};
+    for (int i = 0; i < 3; i++)
+    {
+        free_block(holes[i]);
+    }
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    uint got[3];
+    for (int i = 0; i < 3; i++)
+    {
+        got[i] = allocate_block_uninit();
+    }
+    cache_get_stats(&after);
+    mt_assert(after.class_hits[BC_BITMAP] + after.class_misses[BC_BITMAP] ==
+              before.class_hits[BC_BITMAP] + before.class_misses[BC_BITMAP]);
+    // next-fit 从上一次分配之后开始, 回绕后依次找到三个空洞
+    mt_assert(got[0] == holes[0] && got[1] == holes[1] && got[2] == holes[2]);
+    mt_assert(allocate_block_uninit() == 0);
+
+    // 修改过的位图块在 bitmap_sync 时写回
+    mt_assert(bitmap_sync() > 0);
+    uchar buf[BSIZE];
+    read_block(BBLOCK(holes[1]), buf);
+    mt_assert(buf[(holes[1] % BPB) / 8] & (1 << (holes[1] % 8)));
+    mt_assert(bitmap_sync() == 0);
+    return 0;
+}
+
+mt_test(test_free_extent_allocator)
+{
+    mock_format();
+    uint blocks[20];
+    for (int i = 0; i < 20; i++)
+    {
+        blocks[i] = allocate_block_uninit();
+        mt_assert(blocks[i] == nmeta + i);
+    }
+    // 隔一个释放一个, 留下 10 个单块空洞
+    for (int i = 0; i < 20; i += 2)
+    {
+        free_block(blocks[i]);
+    }
+    alloc_stats_t st;
+    alloc_get_stats(&st);
+    mt_assert(st.free_extents == 11); // 10 个空洞加上数据区末尾
+    mt_assert(st.hist[0] == 10);
+    mt_assert(st.free_blocks == sb.size - nmeta - 10);
+
+    // 需要 4 个连续块时跳过单块空洞
+    uint start;
+    mt_assert(allocate_blocks(nmeta, 4, &start) == 4);
+    mt_assert(start == nmeta + 20);
+
+    // 目标块空闲时从目标块开始; 释放时与相邻区间合并
+    mt_assert(allocate_blocks(nmeta + 40, 3, &start) == 3 && start == nmeta + 40);
+    free_block(nmeta + 41);
+    free_block(blocks[1]);
+    alloc_get_stats(&st);
+    mt_assert(st.free_extents == 12); // 块 1 与块 0, 2 的空洞合并, 41 单独一个区间
+    free_block(nmeta + 40);
+    free_block(nmeta + 42);
+    alloc_get_stats(&st);
+    mt_assert(st.free_extents == 10); // 40~42 与左右两侧的空闲区间合并
+    mt_assert(st.largest == sb.size - nmeta - 24);
+    return 0;
+}
+
+mt_test(test_stream_read_keeps_hot_blocks)
+{
+    uchar buf[BSIZE];
+    // 先写入一些热块
+    for (int i = 0; i < 8; i++)
+    {
+        memset(buf, 'a' + i, BSIZE);
+        write_block(2000 + i, buf);
+    }
+    // 流式读取远多于缓存容量的块
+    for (int i = 0; i < 3 * BLOCK_CACHE_SIZE; i++)
+    {
+        read_block_stream(10000 + i, buf);
+    }
+
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    for (int i = 0; i < 8; i++)
+    {
+        read_block(2000 + i, buf);
+        mt_assert(buf[0] == 'a' + i && buf[BSIZE - 1] == 'a' + i);
+    }
+    cache_get_stats(&after);
+    mt_assert(after.hits - before.hits == 8); // 热块没有被挤出缓存
+    return 0;
+}
+
+mt_test(test_data_does_not_evict_metadata)
+{
+    mock_format();
+    uchar buf[BSIZE], meta[BSIZE];
+    read_block(sb.inodestart, meta);
+
+    // 写入远多于缓存容量的文件数据块
+    memset(buf, 'x', BSIZE);
+    for (int i = 0; i < 2 * BLOCK_CACHE_SIZE; i++)
+    {
+        write_block(20000 + i, buf);
+    }
+
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    read_block(sb.inodestart, buf);
+    cache_get_stats(&after);
+    mt_assert(after.class_hits[BC_INODE] - before.class_hits[BC_INODE] == 1);
+    mt_assert(memcmp(buf, meta, BSIZE) == 0);
+    return 0;
+}
+
 void block_tests()
 {
     mt_run_test(test_read_write_block);
@@ -149,4 +319,9 @@ void block_tests()
     mt_run_test(test_allocate_block);
     mt_run_test(test_allocate_block_all);
     mt_run_test(test_free_block);
+    mt_run_test(test_free_without_zero_fill);
+    mt_run_test(test_bitmap_nearly_full);
+    mt_run_test(test_free_extent_allocator);
+    mt_run_test(test_stream_read_keeps_hot_blocks);
+    mt_run_test(test_data_does_not_evict_metadata);
 }
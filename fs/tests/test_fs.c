@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "block.h"
 #include "common.h"
@@ -8,6 +9,8 @@
 #include "inode.h"
 #include "mintest.h"
 #include "log.h"
+#include "orphan.h"
+#include "simple_cache.h"
 
 int ncyl, nsec;
 
@@ -185,6 +188,207 @@ mt_test(test_small_file_ops)
     return 0;
 }
 
+static uint inum_of(char *name)
+{
+    entry *entries;
+    int n;
+    uint inum = 0;
+    cmd_ls(&entries, &n);
+    for (int i = 0; i < n; i++)
+        if (strcmp(entries[i].name, name) == 0)
+            inum = entries[i].inum;
+    free(entries);
+    return inum;
+}
+
+mt_test(test_cylinder_groups)
+{
+    format();
+    mt_assert(cg_count() > 1);
+
+    // 新目录分散到不同的柱面组
+    mt_assert(cmd_mkdir("a", 0b1111) == E_SUCCESS);
+    mt_assert(cmd_mkdir("b", 0b1111) == E_SUCCESS);
+    uint a = inum_of("a"), b = inum_of("b");
+    mt_assert(a / sb.ipg != b / sb.ipg);
+
+    // 文件放在父目录所在的组, 数据块也在这个组中
+    char data[3 * BSIZE];
+    memset(data, 'g', sizeof(data));
+    mt_assert(cmd_cd("a") == E_SUCCESS);
+    cmd_mk("f", 0b1111);
+    mt_assert(cmd_w("f", sizeof(data), data) == E_SUCCESS);
+    uint f = inum_of("f");
+    mt_assert(f / sb.ipg == a / sb.ipg);
+    inode *ip = iget(f);
+    mt_assert(ip != NULL);
+    mt_assert(cg_of_block(bmap_lookup(ip, 0)) == a / sb.ipg);
+    mt_assert(cg_of_block(bmap_lookup(ip, 2)) == a / sb.ipg);
+    iput(ip);
+
+    uchar *buf = NULL;
+    uint len;
+    mt_assert(cmd_cat("f", &buf, &len) == E_SUCCESS);
+    mt_assert(len == sizeof(data) && memcmp(buf, data, len) == 0);
+    free(buf);
+    mt_assert(cmd_cd("/") == E_SUCCESS);
+    return 0;
+}
+
+mt_test(test_background_reclaim)
+{
+    cache_init_size(BLOCK_CACHE_SIZE);
+    format();
+    mt_assert(cmd_mk("keep", 0b1111) == E_SUCCESS); // 目录不会因为删空而释放目录块
+    alloc_stats_t st0, st;
+    alloc_get_stats(&st0);
+    int len = 300 * BSIZE;
+    char *data = malloc(len);
+    memset(data, 'r', len);
+
+    // 没有回收线程时, rm 在命令结束前回收完
+    mt_assert(cmd_mk("big", 0b1111) == E_SUCCESS);
+    mt_assert(cmd_w("big", len, data) == E_SUCCESS);
+    mt_assert(cmd_rm("big") == E_SUCCESS);
+    alloc_get_stats(&st);
+    mt_assert(sb.norphan == 0 && st.free_blocks == st0.free_blocks);
+
+    // 回收到一半时崩溃: 孤儿表在块 0 中, 重新挂载后从剩下的部分继续
+    mt_assert(cmd_mk("big", 0b1111) == E_SUCCESS);
+    mt_assert(cmd_w("big", len, data) == E_SUCCESS);
+    uint inum = inum_of("big");
+    inode *ip = iget(inum);
+    mt_assert(ip != NULL);
+    ip->nlink = 0;
+    ip->flags |= IF_ORPHAN;
+    ip->dirty = 1;
+    iupdate(ip);
+    mt_assert(orphan_add(inum) == 0);
+    itrunc(ip, inode_mapped_end(ip) - RECLAIM_BATCH);
+    iupdate(ip);
+    iput(ip);
+    icache_invalidate();
+    superblock disk_sb;
+    uchar buf[BSIZE];
+    read_block(0, buf);
+    memcpy(&disk_sb, buf, sizeof(disk_sb));
+    mt_assert(disk_sb.norphan == 1 && disk_sb.orphans[0] == inum);
+    sb = disk_sb;
+    reclaim_drain();
+    alloc_get_stats(&st);
+    mt_assert(sb.norphan == 0 && st.free_blocks == st0.free_blocks);
+
+    // 有回收线程时, rm 立即返回, 由线程释放数据块
+    format();
+    mt_assert(cmd_mk("keep", 0b1111) == E_SUCCESS);
+    alloc_get_stats(&st0);
+    mt_assert(reclaim_start() == 0);
+    mt_assert(cmd_mk("big", 0b1111) == E_SUCCESS);
+    mt_assert(cmd_w("big", len, data) == E_SUCCESS);
+    fs_lock(); // 和服务器一样, 命令执行期间回收线程停在两批之间
+    mt_assert(cmd_rm("big") == E_SUCCESS);
+    fs_unlock();
+    mt_assert(!exist("big", T_FILE));
+    for (int i = 0; i < 500 && orphan_pending() > 0; i++)
+        usleep(10000);
+    reclaim_stop();
+    alloc_get_stats(&st);
+    mt_assert(sb.norphan == 0 && st.free_blocks == st0.free_blocks);
+
+    free(data);
+    return 0;
+}
+
+mt_test(test_pwrite_append)
+{
+    format();
+    mt_assert(cmd_mk("log", 0b1111) == E_SUCCESS);
+    mt_assert(cmd_w("log", 11, "hello world") == E_SUCCESS);
+    mt_assert(cmd_pwrite("log", 6, 5, "WORLD") == E_SUCCESS);
+    mt_assert(cmd_pwrite("log", 13, 1, "!") == E_SUCCESS); // 越过文件尾, 中间补零
+    mt_assert(cmd_append("log", 3, "abc") == E_SUCCESS);
+    uchar *buf;
+    uint len;
+    mt_assert(cmd_cat("log", &buf, &len) == E_SUCCESS);
+    mt_assert(len == 17 && memcmp(buf, "hello WORLD\0\0!abc", 17) == 0);
+    free(buf);
+
+    // 片段表文件的覆盖写和追加只改表
+    char big[1500];
+    memset(big, 'z', sizeof(big));
+    mt_assert(cmd_w("log", sizeof(big), big) == E_SUCCESS);
+    mt_assert(cmd_pieces("log", 1) == E_SUCCESS);
+    mt_assert(cmd_pwrite("log", 700, 4, "MIDL") == E_SUCCESS);
+    for (int i = 0; i < 10; i++)
+        mt_assert(cmd_append("log", 2, "ab") == E_SUCCESS);
+    inode *ip = iget(inum_of("log"));
+    mt_assert(ip != NULL && piece_count(ip) == 4);
+    iput(ip);
+    memcpy(big + 700, "MIDL", 4);
+    mt_assert(cmd_cat("log", &buf, &len) == E_SUCCESS);
+    mt_assert(len == sizeof(big) + 20 && memcmp(buf, big, sizeof(big)) == 0 && memcmp(buf + len - 4, "abab", 4) == 0);
+    free(buf);
+
+    mt_assert(cmd_pwrite("log", 0xFFFFFFFFu, 2, "xy") == E_ERROR); // off + n 溢出不能绕过上限
+    mt_assert(cmd_pwrite("log", MAXFILE, 1, "x") == E_ERROR);
+    mt_assert(cmd_pwrite("ghost", 0, 1, "x") == E_ERROR);
+    mt_assert(cmd_append("ghost", 1, "x") == E_ERROR);
+    return 0;
+}
+
+typedef struct
+{
+    uchar data[8192];
+    uint len;
+    int calls;
+    int stop; // 第 stop 段之后停止读取, 0 表示不停
+} read_sink;
+
+static int collect(void *arg, const uchar *data, uint n)
+{
+    read_sink *rs = arg;
+    if (n > READ_CHUNK)
+        return -1;
+    memcpy(rs->data + rs->len, data, n);
+    rs->len += n;
+    return ++rs->calls == rs->stop ? -1 : 0;
+}
+
+mt_test(test_ranged_read)
+{
+    format();
+    char data[5000];
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = 'a' + i % 26;
+    mt_assert(cmd_mk("big", 0b1111) == E_SUCCESS);
+    mt_assert(cmd_w("big", sizeof(data), data) == E_SUCCESS);
+
+    // 整个文件按 READ_CHUNK 分段读出
+    read_sink rs = {.len = 0, .calls = 0, .stop = 0};
+    mt_assert(cmd_read("big", 0, MAXFILE, collect, &rs) == E_SUCCESS);
+    mt_assert(rs.len == sizeof(data) && memcmp(rs.data, data, sizeof(data)) == 0);
+    mt_assert(rs.calls == (sizeof(data) + READ_CHUNK - 1) / READ_CHUNK);
+
+    // 中间一段, 以及越过文件尾的长度
+    rs.len = rs.calls = 0;
+    mt_assert(cmd_read("big", 1234, 100, collect, &rs) == E_SUCCESS);
+    mt_assert(rs.len == 100 && memcmp(rs.data, data + 1234, 100) == 0);
+    rs.len = rs.calls = 0;
+    mt_assert(cmd_read("big", 4990, 100, collect, &rs) == E_SUCCESS);
+    mt_assert(rs.len == 10 && memcmp(rs.data, data + 4990, 10) == 0);
+    rs.len = rs.calls = 0;
+    mt_assert(cmd_read("big", 5000, 10, collect, &rs) == E_SUCCESS && rs.len == 0);
+    mt_assert(cmd_read("big", 5001, 10, collect, &rs) == E_ERROR);
+    mt_assert(cmd_read("ghost", 0, 10, collect, &rs) == E_ERROR);
+
+    // 回调返回负数时停止读取, 没读完不算成功
+    rs.len = rs.calls = 0;
+    rs.stop = 2;
+    mt_assert(cmd_read("big", 0, MAXFILE, collect, &rs) == E_ERROR);
+    mt_assert(rs.calls == 2 && rs.len == 2 * READ_CHUNK);
+    return 0;
+}
+
 static void generate_random_name(char *name, int length)
 {
     const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -286,6 +490,10 @@ void fs_tests()
     mt_run_test(test_cmd_rmdir_with_files);
     mt_run_test(test_file_lifecycle);
     mt_run_test(test_small_file_ops);
+    mt_run_test(test_cylinder_groups);
+    mt_run_test(test_background_reclaim);
+    mt_run_test(test_pwrite_append);
+    mt_run_test(test_ranged_read);
     mt_run_test(test_folder_tree_operations);
     mt_run_test(test_folder_tree_with_rm);
 }
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "mintest.h"
 #include "fs.h"
+#include "simple_cache.h"
 #include <time.h>
 #include <stdlib.h>
 
@@ -79,7 +80,8 @@ mt_test(test_writei)
     int bytes_written = writei(ip, data, 0, sizeof(data));
     mt_assert(bytes_written == sizeof(data));
     mt_assert(ip->size == sizeof(data));
-    mt_assert(ip->blocks > 0);
+    mt_assert(ip->flags & IF_INLINE); // small files stay inside the inode
+    mt_assert(ip->blocks == 0);
 
     // Verify the written data
     uchar buf[sizeof(data)];
@@ -201,6 +203,556 @@ mt_test(test_random_binary_read_write)
     return 0;
 }
 
+mt_test(test_sparse_file)
+{
+    cmd_login(1);
+    cache_init_size(BLOCK_CACHE_SIZE); // start from an empty cache so earlier tests' metadata does not crowd out the data
+    cmd_format(1024, 63, 0);           // block-mapped inodes
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+
+    // Write past EOF leaves a hole
+    uchar data[] = "tail";
+    uint off = (NDIRECT + 20) * BSIZE;
+    int bytes_written = writei(ip, data, off, sizeof(data));
+    mt_assert(bytes_written == sizeof(data));
+    mt_assert(ip->size == off + sizeof(data));
+    mt_assert(ip->blocks == 2); // indirect block + data block
+    mt_assert(bmap_lookup(ip, 0) == 0);
+
+    // Holes read back as zeros and reading does not allocate
+    uchar *buf = malloc(ip->size);
+    mt_assert(buf != NULL);
+    int bytes_read = readi(ip, buf, 0, ip->size);
+    mt_assert(bytes_read == ip->size);
+    for (uint i = 0; i < off; i++)
+    {
+        mt_assert(buf[i] == 0);
+    }
+    mt_assert(memcmp(buf + off, data, sizeof(data)) == 0);
+    mt_assert(ip->blocks == 2);
+
+    // Stale bytes past a shrunk EOF must not reappear
+    uchar head[BSIZE];
+    memset(head, 'a', sizeof(head));
+    writei(ip, head, 0, sizeof(head));
+    ip->size = 10;
+    writei(ip, data, 100, sizeof(data));
+    bytes_read = readi(ip, buf, 0, ip->size);
+    mt_assert(bytes_read == 100 + sizeof(data));
+    mt_assert(buf[9] == 'a' && buf[10] == 0 && buf[99] == 0);
+
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_extent_mapping)
+{
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    mt_assert(ip->flags & IF_EXTENTS);
+
+    // A sequential file past the indirect range maps with one or two extents
+    const uint data_size = (NDIRECT + APB + 20) * BSIZE;
+    uchar *data = malloc(data_size);
+    uchar *buf = malloc(data_size);
+    mt_assert(data != NULL && buf != NULL);
+    for (uint i = 0; i < data_size; i++)
+    {
+        data[i] = i * 7 + 3;
+    }
+    mt_assert(writei(ip, data, 0, data_size) == data_size);
+    mt_assert(inode_extent_count(ip) >= 1 && inode_extent_count(ip) <= 2);
+    mt_assert(ip->blocks == data_size / BSIZE);
+    mt_assert(readi(ip, buf, 0, data_size) == data_size);
+    mt_assert(memcmp(data, buf, data_size) == 0);
+
+    // Writing every other block fragments the map and spills into overflow blocks
+    inode *other = ialloc(T_FILE);
+    mt_assert(other != NULL);
+    for (uint i = 0; i < 60; i++)
+    {
+        mt_assert(writei(other, data, i * 2 * BSIZE, BSIZE) == BSIZE); // every other block is a hole
+    }
+    mt_assert(inode_extent_count(other) == 60);
+    mt_assert(other->addrs[EXT_OVERFLOW] != 0);
+    mt_assert(other->blocks == 60 + 2); // data + two overflow blocks
+    mt_assert(readi(other, buf, 0, other->size) == other->size);
+    for (uint i = 0; i < 60; i++)
+    {
+        mt_assert(memcmp(buf + i * 2 * BSIZE, data, BSIZE) == 0);
+        if (i + 1 < 60)
+        {
+            mt_assert(buf[(i * 2 + 1) * BSIZE] == 0);
+        }
+    }
+
+    // Truncating below the overflow extents frees the emptied overflow blocks too
+    alloc_stats_t st0, st;
+    alloc_get_stats(&st0);
+    mt_assert(itrunc(other, 5) == 57 + 2);
+    mt_assert(inode_extent_count(other) == 3 && other->addrs[EXT_OVERFLOW] == 0 && other->blocks == 3);
+    alloc_get_stats(&st);
+    mt_assert(st.free_blocks == st0.free_blocks + 57 + 2);
+    for (uint i = 3; i < 60; i++)
+        mt_assert(writei(other, data, i * 2 * BSIZE, BSIZE) == BSIZE);
+    mt_assert(inode_extent_count(other) == 60 && other->blocks == 60 + 2);
+
+    // Freeing returns every block and keeps the inode extent-mapped
+    free_inode_blocks(other);
+    mt_assert(inode_extent_count(other) == 0);
+    mt_assert(other->blocks == 0);
+
+    free(data);
+    free(buf);
+    iput(other);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_inline_data)
+{
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    uint inum = ip->inum;
+
+    // Small writes stay inline and survive a reload
+    uchar note[] = "inline note";
+    mt_assert(writei(ip, note, 0, sizeof(note)) == sizeof(note));
+    mt_assert(writei(ip, note, 30, sizeof(note)) == sizeof(note));
+    mt_assert(ip->flags & IF_INLINE);
+    mt_assert(ip->blocks == 0);
+    iput(ip);
+
+    ip = iget(inum);
+    mt_assert(ip != NULL);
+    uchar buf[BSIZE * 2];
+    mt_assert(readi(ip, buf, 0, ip->size) == 30 + sizeof(note));
+    mt_assert(memcmp(buf, note, sizeof(note)) == 0);
+    mt_assert(buf[sizeof(note)] == 0 && buf[29] == 0);
+    mt_assert(memcmp(buf + 30, note, sizeof(note)) == 0);
+
+    // Growing past INLINE_MAX spills the existing bytes into a block
+    uchar big[BSIZE];
+    memset(big, 'b', sizeof(big));
+    mt_assert(writei(ip, big, 100, sizeof(big)) == sizeof(big));
+    mt_assert(!(ip->flags & IF_INLINE));
+    mt_assert(ip->blocks == 2);
+    mt_assert(readi(ip, buf, 0, ip->size) == 100 + sizeof(big));
+    mt_assert(memcmp(buf + 30, note, sizeof(note)) == 0);
+    mt_assert(buf[99] == 0 && buf[100] == 'b' && buf[100 + BSIZE - 1] == 'b');
+
+    // Emptying the file makes it inline again
+    free_inode_blocks(ip);
+    mt_assert(ip->flags & IF_INLINE);
+    mt_assert(ip->blocks == 0);
+
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_icache)
+{
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    uint inum = ip->inum;
+
+    // Repeated iget returns the same object with a shared view of its fields
+    inode *again = iget(inum);
+    mt_assert(again == ip);
+    mt_assert(ip->ref == 2);
+    again->size = 77;
+    again->dirty = 1;
+    mt_assert(ip->size == 77);
+    iput(again);
+    iput(ip);
+    mt_assert(ip->ref == 0);
+
+    // Unreferenced inodes stay cached until the slot is needed
+    mt_assert(iget(inum) == ip);
+    iput(ip);
+
+    // More live inodes than slots: the oldest unreferenced ones are evicted and reload intact
+    uint inums[ICACHE_SIZE + 8];
+    for (int i = 0; i < ICACHE_SIZE + 8; i++)
+    {
+        inode *t = ialloc(T_FILE);
+        mt_assert(t != NULL);
+        inums[i] = t->inum;
+        t->size = i;
+        t->dirty = 1;
+        iput(t);
+    }
+    inode *first = iget(inums[0]);
+    mt_assert(first != NULL && first->size == 0);
+    iput(first);
+    inode *reloaded = iget(inum);
+    mt_assert(reloaded != NULL && reloaded->size == 77);
+
+    // Dropping the last link frees the inode on the final iput
+    reloaded->nlink = 0;
+    iput(reloaded);
+    mt_assert(iget(inum) == NULL);
+    return 0;
+}
+
+mt_test(test_indirect_map_cache)
+{
+    cmd_login(1);
+    cache_init_size(BLOCK_CACHE_SIZE); // start from an empty cache so earlier tests' metadata does not crowd out the data
+    cmd_format(1024, 63, 0);           // block-mapped inodes
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+
+    // Reaches into the double indirect range (kept small enough to stay in the block cache)
+    const uint nblocks = NDIRECT + APB + 20;
+    uchar *data = malloc(nblocks * BSIZE);
+    mt_assert(data != NULL);
+    for (uint i = 0; i < nblocks * BSIZE; i++)
+    {
+        data[i] = i % 251;
+    }
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+
+    // A sequential scan decodes each indirect block at most once
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    uchar buf[BSIZE];
+    for (uint b = 0; b < nblocks; b++)
+    {
+        mt_assert(readi(ip, buf, b * BSIZE, BSIZE) == BSIZE);
+        mt_assert(memcmp(buf, data + b * BSIZE, BSIZE) == 0);
+    }
+    cache_get_stats(&after);
+    long reads = after.class_hits[BC_INDIRECT] + after.class_misses[BC_INDIRECT] - before.class_hits[BC_INDIRECT] -
+                 before.class_misses[BC_INDIRECT];
+    mt_assert(reads <= 3); // indirect, double indirect, one level-1 block
+
+    // Truncating drops the decoded map, so reused blocks are not mapped through stale copies
+    free_inode_blocks(ip);
+    mt_assert(bmap_lookup(ip, NDIRECT + 1) == 0);
+    mt_assert(writei(ip, data, 0, (NDIRECT + 2) * BSIZE) == (NDIRECT + 2) * BSIZE);
+    mt_assert(readi(ip, buf, (NDIRECT + 1) * BSIZE, BSIZE) == BSIZE);
+    mt_assert(memcmp(buf, data + (NDIRECT + 1) * BSIZE, BSIZE) == 0);
+
+    free(data);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_batched_allocation)
+{
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+
+    // An unaligned multi-block write allocates one contiguous run without reading the new blocks
+    const uint len = 40 * BSIZE + 100;
+    uchar *data = malloc(len);
+    uchar *buf = malloc(len + 200);
+    mt_assert(data != NULL && buf != NULL);
+    for (uint i = 0; i < len; i++)
+    {
+        data[i] = i * 13 + 1;
+    }
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    mt_assert(writei(ip, data, 200, len) == len);
+    cache_get_stats(&after);
+    long data_reads = after.class_hits[BC_DATA] + after.class_misses[BC_DATA] - before.class_hits[BC_DATA] -
+                      before.class_misses[BC_DATA];
+    long bitmap_reads = after.class_hits[BC_BITMAP] + after.class_misses[BC_BITMAP] -
+                        before.class_hits[BC_BITMAP] - before.class_misses[BC_BITMAP];
+    mt_assert(data_reads == 0);
+    mt_assert(bitmap_reads <= 4); // one pass, not one scan per block
+    mt_assert(inode_extent_count(ip) == 1);
+    mt_assert(ip->blocks == 41);
+    for (uint b = 1; b < 41; b++)
+    {
+        mt_assert(bmap_lookup(ip, b) == bmap_lookup(ip, 0) + b);
+    }
+
+    // The head of the first block and the tail of the last block read as zeros
+    mt_assert(readi(ip, buf, 0, ip->size) == len + 200);
+    mt_assert(buf[0] == 0 && buf[199] == 0);
+    mt_assert(memcmp(buf + 200, data, len) == 0);
+    mt_assert(readi(ip, buf, 0, 41 * BSIZE) == len + 200);
+
+    // Overwriting mapped blocks keeps the existing run
+    uint first = bmap_lookup(ip, 0);
+    mt_assert(writei(ip, data, 0, 3 * BSIZE) == 3 * BSIZE);
+    mt_assert(bmap_lookup(ip, 0) == first && inode_extent_count(ip) == 1);
+
+    free(data);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_prealloc_windows)
+{
+    cache_init_size(BLOCK_CACHE_SIZE);
+    format();
+    inode *a = ialloc(T_FILE);
+    inode *b = ialloc(T_FILE);
+    mt_assert(a != NULL && b != NULL);
+    alloc_stats_t st0, st;
+    alloc_get_stats(&st0);
+
+    // Two files appended to in turn, one block at a time, each stay in a few runs
+    uchar blk[BSIZE];
+    for (uint i = 0; i < 40; i++)
+    {
+        memset(blk, 'a' + i % 26, BSIZE);
+        mt_assert(writei(a, blk, i * BSIZE, BSIZE) == BSIZE);
+        memset(blk, 'A' + i % 26, BSIZE);
+        mt_assert(writei(b, blk, i * BSIZE, BSIZE) == BSIZE);
+    }
+    mt_assert(inode_extent_count(a) <= 5);
+    mt_assert(inode_extent_count(b) <= 5);
+    mt_assert(readi(a, blk, 39 * BSIZE, BSIZE) == BSIZE && blk[0] == 'a' + 39 % 26);
+
+    alloc_get_stats(&st);
+    mt_assert(st.reserved > st0.reserved);
+
+    // Deleting the files hands the unused reservations back
+    a->nlink = b->nlink = 0;
+    iput(a);
+    iput(b);
+    alloc_get_stats(&st);
+    mt_assert(st.reserved == st0.reserved);
+    return 0;
+}
+
+mt_test(test_fallocate)
+{
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+
+    // Preallocated blocks form one run, the size is unchanged and they read as zeros
+    mt_assert(ifallocate(ip, 20 * BSIZE) == 20);
+    mt_assert(ip->size == 0 && inode_extent_count(ip) == 1);
+    uint first = bmap_lookup(ip, 0);
+    mt_assert(first != 0 && bmap_lookup(ip, 19) == first + 19 && bmap_lookup(ip, 20) == 0);
+
+    // The blocks are really zeroed: the uninitialized flag does not survive a restart
+    uchar raw[BSIZE];
+    memset(raw, 'X', BSIZE);
+    cached_read_block(first + 19, raw, BC_DATA);
+    mt_assert(!block_uninit(first) && !block_uninit(first + 19) && raw[0] == 0 && raw[BSIZE - 1] == 0);
+
+    // Later writes go into the preallocated blocks
+    uchar *data = malloc(20 * BSIZE);
+    uchar *buf = malloc(20 * BSIZE);
+    mt_assert(data != NULL && buf != NULL);
+    for (uint i = 0; i < 20 * BSIZE; i++)
+        data[i] = i * 7 + 3;
+    mt_assert(writei(ip, data, 0, 10 * BSIZE + 5) == 10 * BSIZE + 5);
+    mt_assert(bmap_lookup(ip, 0) == first && inode_extent_count(ip) == 1);
+    mt_assert(readi(ip, buf, 0, 20 * BSIZE) == 10 * BSIZE + 5);
+    mt_assert(memcmp(buf, data, 10 * BSIZE + 5) == 0);
+
+    // Already mapped blocks are kept
+    mt_assert(ifallocate(ip, 20 * BSIZE) == 0);
+
+    free(data);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_delayed_allocation)
+{
+    cache_init_size(BLOCK_CACHE_SIZE);
+    format();
+    delalloc_set(1);
+    inode *a = ialloc(T_FILE);
+    inode *b = ialloc(T_FILE);
+    mt_assert(a != NULL && b != NULL);
+
+    // Interleaved appends stay in memory: no block is allocated until the flush
+    alloc_stats_t st0, st;
+    alloc_get_stats(&st0);
+    uchar blk[BSIZE];
+    for (uint i = 0; i < 20; i++)
+    {
+        memset(blk, 'a' + i, BSIZE);
+        mt_assert(writei(a, blk, i * BSIZE, BSIZE) == BSIZE);
+        memset(blk, 'A' + i, BSIZE);
+        mt_assert(writei(b, blk, i * BSIZE, BSIZE) == BSIZE);
+    }
+    alloc_get_stats(&st);
+    mt_assert(st.allocs == st0.allocs);
+    mt_assert(bmap_lookup(a, 0) == 0 && a->size == 20 * BSIZE);
+    mt_assert(readi(a, blk, 7 * BSIZE, BSIZE) == BSIZE && blk[0] == 'a' + 7 && blk[BSIZE - 1] == 'a' + 7);
+
+    // The flush gives each file one contiguous run
+    delalloc_flush(1);
+    mt_assert(inode_extent_count(a) == 1 && inode_extent_count(b) == 1);
+    mt_assert(bmap_lookup(a, 19) == bmap_lookup(a, 0) + 19);
+    mt_assert(readi(b, blk, 19 * BSIZE, BSIZE) == BSIZE && blk[0] == 'A' + 19);
+
+    // A file deleted before the flush never touches the bitmap
+    inode *tmp = ialloc(T_FILE);
+    mt_assert(tmp != NULL);
+    alloc_get_stats(&st0);
+    for (uint i = 0; i < 4; i++)
+        mt_assert(writei(tmp, blk, i * BSIZE, BSIZE) == BSIZE);
+    tmp->nlink = 0;
+    iput(tmp);
+    alloc_get_stats(&st);
+    mt_assert(st.allocs == st0.allocs && st.frees == st0.frees);
+
+    delalloc_set(0);
+    iput(a);
+    iput(b);
+    return 0;
+}
+
+mt_test(test_shift)
+{
+    cache_init_size(BLOCK_CACHE_SIZE);
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    uint cap = 40 * BSIZE;
+    uchar *ref = malloc(cap), *buf = malloc(cap);
+    uint size = 20 * BSIZE + 100;
+    for (uint i = 0; i < size; i++)
+        ref[i] = rand() % 256;
+    mt_assert(writei(ip, ref, 0, size) == size);
+
+    // Inserts and deletes at unaligned positions, including ones longer than a block
+    uint ops[][3] = {{1, 700, 3}, {1, 0, 600}, {0, 513, 1500}, {1, 5000, 2000}, {0, 10, 5}, {1, 0, 1}};
+    for (uint k = 0; k < sizeof(ops) / sizeof(ops[0]); k++)
+    {
+        uint pos = ops[k][1], len = ops[k][2];
+        if (ops[k][0])
+        {
+            uchar ins[2048];
+            for (uint i = 0; i < len; i++)
+                ins[i] = rand() % 256;
+            mt_assert(ishift(ip, pos, len) == 0);
+            mt_assert(writei(ip, ins, pos, len) == len);
+            memmove(ref + pos + len, ref + pos, size - pos);
+            memcpy(ref + pos, ins, len);
+            size += len;
+        }
+        else
+        {
+            mt_assert(ishift(ip, pos + len, -(int)len) == 0);
+            memmove(ref + pos, ref + pos + len, size - pos - len);
+            size -= len;
+        }
+        mt_assert(ip->size == size);
+        mt_assert(readi(ip, buf, 0, size) == size && memcmp(buf, ref, size) == 0);
+    }
+
+    // Deleting most of the file frees the blocks past the new end
+    mt_assert(ishift(ip, size - 100, -(int)(size - 200)) == 0);
+    mt_assert(ip->size == 200 && inode_mapped_end(ip) == 1);
+    mt_assert(readi(ip, buf, 0, 200) == 200 && memcmp(buf, ref, 100) == 0 && memcmp(buf + 100, ref + size - 100, 100) == 0);
+    mt_assert(ishift(ip, 0, -1) == -1);
+
+    free(ref);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_piece_table)
+{
+    cache_init_size(BLOCK_CACHE_SIZE);
+    format();
+    alloc_stats_t st0, st;
+    alloc_get_stats(&st0);
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    uint cap = 24 * BSIZE;
+    uchar *ref = malloc(cap), *buf = malloc(cap);
+    uint size = 10 * BSIZE + 7;
+    for (uint i = 0; i < size; i++)
+        ref[i] = rand() % 256;
+    mt_assert(writei(ip, ref, 0, size) == size);
+    mt_assert(piece_count(ip) == -1);
+    mt_assert(ipieces(ip, 1) == 0);
+    mt_assert(piece_count(ip) == 1);
+
+    // Edits only touch the table and the end of the log
+    for (int k = 0; k < 100; k++)
+    {
+        uint pos = rand() % (size + 1);
+        uint len = 1 + rand() % 20;
+        if (k % 3 != 2)
+        {
+            uchar ins[20];
+            for (uint i = 0; i < len; i++)
+                ins[i] = rand() % 256;
+            mt_assert(iinsert(ip, pos, ins, len) == 0);
+            memmove(ref + pos + len, ref + pos, size - pos);
+            memcpy(ref + pos, ins, len);
+            size += len;
+        }
+        else if (pos < size)
+        {
+            len = min(len, size - pos);
+            mt_assert(idelete(ip, pos, len) == 0);
+            memmove(ref + pos, ref + pos + len, size - pos - len);
+            size -= len;
+        }
+        mt_assert(ip->size == size);
+    }
+    mt_assert(piece_count(ip) > PIECE_COMPACT);
+    mt_assert(readi(ip, buf, 0, size) == size && memcmp(buf, ref, size) == 0);
+    mt_assert(readi(ip, buf, 777, 1000) == 1000 && memcmp(buf, ref + 777, 1000) == 0);
+
+    // Typing at one spot keeps extending the same piece
+    int before = piece_count(ip);
+    for (uint i = 0; i < 5; i++)
+    {
+        mt_assert(iinsert(ip, 100 + i, (uchar *)"x", 1) == 0);
+        memmove(ref + 101 + i, ref + 100 + i, size - 100 - i);
+        ref[100 + i] = 'x';
+        size++;
+    }
+    mt_assert(piece_count(ip) <= before + 2);
+
+    // Compaction at the end of a command gives one piece over a flat log
+    piece_compact_pending();
+    mt_assert(piece_count(ip) == 1);
+    mt_assert(inode_mapped_end(ip) == (size + BSIZE - 1) / BSIZE);
+    mt_assert(readi(ip, buf, 0, size) == size && memcmp(buf, ref, size) == 0);
+
+    // Plain writes and switching back keep the content
+    mt_assert(writei(ip, (uchar *)"hello", 3, 5) == 5);
+    memcpy(ref + 3, "hello", 5);
+    mt_assert(iinsert(ip, 0, (uchar *)"ab", 2) == 0);
+    memmove(ref + 2, ref, size);
+    memcpy(ref, "ab", 2);
+    size += 2;
+    mt_assert(ipieces(ip, 0) == 0);
+    mt_assert(piece_count(ip) == -1 && !(ip->flags & IF_PIECES));
+    mt_assert(readi(ip, buf, 0, size) == size && memcmp(buf, ref, size) == 0);
+
+    // Freeing a piece-table file returns the table blocks too
+    mt_assert(ipieces(ip, 1) == 0);
+    mt_assert(idelete(ip, 10, 30) == 0);
+    ip->nlink = 0;
+    iput(ip);
+    delalloc_flush(1);
+    alloc_get_stats(&st);
+    mt_assert(st.free_blocks == st0.free_blocks);
+
+    free(ref);
+    free(buf);
+    return 0;
+}
+
 void inode_tests()
 {
     mt_run_test(test_iget);
@@ -210,4 +762,15 @@ void inode_tests()
     mt_run_test(test_readi);
     mt_run_test(test_read_write_mixed);
     mt_run_test(test_random_binary_read_write);
+    mt_run_test(test_sparse_file);
+    mt_run_test(test_extent_mapping);
+    mt_run_test(test_inline_data);
+    mt_run_test(test_icache);
+    mt_run_test(test_indirect_map_cache);
+    mt_run_test(test_batched_allocation);
+    mt_run_test(test_prealloc_windows);
+    mt_run_test(test_fallocate);
+    mt_run_test(test_delayed_allocation);
+    mt_run_test(test_shift);
+    mt_run_test(test_piece_table);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define _TCP_BUFFER_
 
 #define TCP_BUF_SIZE 4096
+#define TCP_SEND_TIMEOUT_MS 5000 /* give up on a peer that has not read anything for this long */
+#define TCP_REPLY_TIMEOUT_MS 10000 /* a server reply, streamed or not, must be delivered within this long */
 
 typedef struct tcp_buffer {
     int read_index;
@@ -46,16 +48,41 @@ int read_to_buffer(tcp_buffer *buf, int sockfd);
 /**
  * @brief  Send buffer
  *
- * Write all the data in the buffer to the socket.
+ * Write all the data in the buffer to the socket, waiting while the peer's
+ * receive window is full. Gives up when the peer accepts nothing for
+ * TCP_SEND_TIMEOUT_MS; the unsent data stays in the buffer.
  *
  * @param  buf     buffer to be read
  * @param  sockfd  socket to be written
+ *
+ * @return int     0 if everything was sent, -1 on error or timeout
+ */
+int send_buffer(tcp_buffer *buf, int sockfd);
+
+/**
+ * @brief  Send buffer before a deadline
+ *
+ * Like send_buffer, but also gives up once the CLOCK_MONOTONIC time in
+ * milliseconds reaches deadline, so a peer that keeps reading a few bytes at
+ * a time cannot hold the sender forever.
+ *
+ * @param  buf       buffer to be read
+ * @param  sockfd    socket to be written
+ * @param  deadline  absolute time in ms (see tcp_now_ms), 0 for none
+ *
+ * @return int       0 if everything was sent, -1 on error or timeout
+ */
+int send_buffer_until(tcp_buffer *buf, int sockfd, long deadline);
+
+/**
+ * @brief  Current CLOCK_MONOTONIC time in milliseconds
  */
-void send_buffer(tcp_buffer *buf, int sockfd);
+long tcp_now_ms(void);
 
 /**
  * @brief  Adjust buffer
  *
+ * If the buffer is empty, reset both indices to 0.
  * If read_index is larger than TCP_BUF_SIZE / 2,
  * move the data to the beginning of the buffer.
  * Used after recycle_read and recycle_write.
@@ -122,4 +149,18 @@ void reply_with_yes(tcp_buffer *buf, const char *s, int len);
 
 void reply_with_no(tcp_buffer *buf, const char *s, int len);
 
+/**
+ * @brief  Reply with "More"
+ *
+ * Append one part of a streamed reply to the buffer.
+ * The first 5 bytes of the message will be "More ".
+ * A streamed reply is any number of "More" messages ended by a "Yes" or "No" message.
+ *
+ * @param  buf   buffer to be written
+ * @param  s     string to be written
+ * @param  len   length of the string
+ */
+
+void reply_with_more(tcp_buffer *buf, const char *s, int len);
+
 #endif
@@ -27,6 +27,22 @@ typedef struct tcp_client_ *tcp_client;
 tcp_server server_init(int port, int num_threads, void (*on_connection)(int id),
                        int (*on_recv)(int id, tcp_buffer *write_buf, char *msg, int len), void (*cleanup)(int id));
 
+/**
+ * @brief  Flush the write buffer
+ *
+ * Send everything in the write buffer to the client whose message is being
+ * handled, blocking while the client is not reading. Only valid inside on_recv;
+ * lets a handler stream a reply larger than the buffer. If the client stops
+ * reading (see send_buffer), or the reply is not delivered within
+ * TCP_REPLY_TIMEOUT_MS of the message being received, the buffer is emptied
+ * and the connection is closed once on_recv returns.
+ *
+ * @param  write_buf  the buffer passed to on_recv
+ *
+ * @return int        0 if sent, -1 if the client is being dropped
+ */
+int server_flush(tcp_buffer *write_buf);
+
 /**
  * @brief  Start the server loop
  *
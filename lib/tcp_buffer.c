@@ -2,9 +2,11 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 tcp_buffer *init_buffer()
@@ -22,6 +24,13 @@ tcp_buffer *init_buffer()
 
 void adjust_buffer(tcp_buffer *buf)
 {
+    if (buf->read_index == buf->write_index)
+    {
+        // buffer drained, rewind so a full-size message fits again
+        buf->read_index = 0;
+        buf->write_index = 0;
+        return;
+    }
     if (buf->read_index > TCP_BUF_SIZE / 2)
     {
         int len = buf->write_index - buf->read_index;
@@ -92,7 +101,9 @@ int read_to_buffer(tcp_buffer *buf, int sockfd)
         int writeable = TCP_BUF_SIZE - buf->write_index;
         if (writeable == 0)
         {
-            fprintf(stderr, "read buffer full\n");
+            // a full buffer after a successful read just means the rest comes next time
+            if (count == 0)
+                fprintf(stderr, "read buffer full\n");
             break;
         }
         int ret = recv(sockfd, &buf->buf[buf->write_index], writeable, 0);
@@ -129,61 +140,82 @@ int read_to_buffer(tcp_buffer *buf, int sockfd)
     return count;
 }
 
-void send_buffer(tcp_buffer *buf, int sockfd)
+long tcp_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+int send_buffer(tcp_buffer *buf, int sockfd) { return send_buffer_until(buf, sockfd, 0); }
+
+int send_buffer_until(tcp_buffer *buf, int sockfd, long deadline)
 {
     while (buf->write_index > buf->read_index)
     {
         int readable = buf->write_index - buf->read_index;
         int ret = send(sockfd, &buf->buf[buf->read_index], readable, 0);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // socket send buffer full: wait for the peer to drain it, but not forever
+            struct pollfd pfd = {.fd = sockfd, .events = POLLOUT};
+            long wait = TCP_SEND_TIMEOUT_MS;
+            if (deadline > 0 && deadline - tcp_now_ms() < wait)
+                wait = deadline - tcp_now_ms();
+            if (wait <= 0)
+            {
+                fprintf(stderr, "send(): peer on fd %d did not take the reply in time\n", sockfd);
+                return -1;
+            }
+            int n = poll(&pfd, 1, wait);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                fprintf(stderr, "send(): peer on fd %d did not take the reply in time\n", sockfd);
+                return -1;
+            }
+            continue;
+        }
         if (ret <= 0)
         {
             perror("send()");
-            break;
+            return -1;
         }
         recycle_read(buf, ret);
     }
+    return 0;
 }
 
 inline void reply(tcp_buffer *buf, const char *s, int len) { buffer_append(buf, s, len); }
 
-void reply_with_yes(tcp_buffer *buf, const char *s, int len)
+// append one packet made of a tag ("Yes ", "No ", "More ") followed by s
+static void reply_with_tag(tcp_buffer *buf, const char *tag, const char *s, int len)
 {
     int writeable = TCP_BUF_SIZE - buf->write_index;
+    int tlen = strlen(tag);
     if (len < 0)
     {
         fprintf(stderr, "invalid length: len cannot be negative\n");
         return;
     }
-    len += 4; // add 4 bytes for "Yes "
+    len += tlen;
     if (writeable < len + 4)
     {
         fprintf(stderr, "write buffer full\n");
         return;
     }
-    memcpy(&buf->buf[buf->write_index + 4], "Yes ", 4);
-    if (len > 4)
-        memcpy(&buf->buf[buf->write_index + 8], s, len - 4);
+    memcpy(&buf->buf[buf->write_index + 4], tag, tlen);
+    if (len > tlen)
+        memcpy(&buf->buf[buf->write_index + 4 + tlen], s, len - tlen);
     *(int *)&buf->buf[buf->write_index] = htonl(len);
     recycle_write(buf, len + 4);
 }
 
-void reply_with_no(tcp_buffer *buf, const char *s, int len)
-{
-    int writeable = TCP_BUF_SIZE - buf->write_index;
-    if (len < 0)
-    {
-        fprintf(stderr, "invalid length: len cannot be negative\n");
-        return;
-    }
-    len += 3; // add 3 bytes for "No "
-    if (writeable < len + 4)
-    {
-        fprintf(stderr, "write buffer full\n");
-        return;
-    }
-    memcpy(&buf->buf[buf->write_index + 4], "No ", 3);
-    if (len > 3)
-        memcpy(&buf->buf[buf->write_index + 7], s, len - 3);
-    *(int *)&buf->buf[buf->write_index] = htonl(len);
-    recycle_write(buf, len + 4);
-}
+void reply_with_yes(tcp_buffer *buf, const char *s, int len) { reply_with_tag(buf, "Yes ", s, len); }
+
+void reply_with_no(tcp_buffer *buf, const char *s, int len) { reply_with_tag(buf, "No ", s, len); }
+
+void reply_with_more(tcp_buffer *buf, const char *s, int len) { reply_with_tag(buf, "More ", s, len); }
@@ -89,6 +89,27 @@ void add_conn(int connfd, struct tcp_server_pool *p, void (*on_connection)(int))
         printf("Too many clients");
 }
 
+/* Socket of the client whose message is being handled by this thread */
+static __thread int recv_fd = -1;
+/* Set when a flush inside on_recv failed; the connection is then closed */
+static __thread int send_failed = 0;
+/* The reply to the message being handled must be sent before this time (tcp_now_ms) */
+static __thread long reply_deadline = 0;
+
+/* Flush the write buffer from inside on_recv */
+int server_flush(tcp_buffer *write_buf)
+{
+    if (recv_fd < 0 || send_failed)
+        return -1;
+    if (send_buffer_until(write_buf, recv_fd, reply_deadline) < 0)
+    {
+        send_failed = 1;
+        recycle_read(write_buf, write_buf->write_index - write_buf->read_index);
+        return -1;
+    }
+    return 0;
+}
+
 /* Arguments for handle_read */
 typedef struct handle_read_args
 {
@@ -130,17 +151,24 @@ void handle_read(void *arg_p)
             // if the message is complete
             if (readable >= len + 4)
             {
+                recv_fd = connfd;
+                reply_deadline = tcp_now_ms() + TCP_REPLY_TIMEOUT_MS;
                 if (server->on_recv(i, write_buf, s + 4, len) < 0)
                     close_flag = 1;
+                recv_fd = -1;
                 recycle_read(read_buf, len + 4);
+                if (send_failed)
+                    break;
             }
             else
                 break;
         }
     }
 
-    // write
-    send_buffer(write_buf, connfd);
+    // write; a client that stops reading is dropped so it cannot stall the other clients
+    if (send_failed || send_buffer_until(write_buf, connfd, tcp_now_ms() + TCP_REPLY_TIMEOUT_MS) < 0)
+        close_flag = 1;
+    send_failed = 0;
 
     if (count < 0 || close_flag)
     {
@@ -320,16 +348,20 @@ void client_send(tcp_client_ *client, const char *msg, int len)
 int client_recv(tcp_client_ *client, char *buf, int max_len)
 {
     tcp_buffer *read_buf = client->read_buf;
-    // read all data from the socket
     while (1)
     {
-        int count = read_to_buffer(read_buf, client->sockfd);
-        if (count <= 0)
+        // a streamed reply can leave more messages in the buffer, use them before reading the socket
+        int readable = read_buf->write_index - read_buf->read_index;
+        if (readable < 4 || readable < (int)ntohl(*(int *)&read_buf->buf[read_buf->read_index]) + 4)
         {
-            printf("Connection closed\n");
-            return 0;
+            int count = read_to_buffer(read_buf, client->sockfd);
+            if (count <= 0)
+            {
+                printf("Connection closed\n");
+                return 0;
+            }
         }
-        int readable = read_buf->write_index - read_buf->read_index;
+        readable = read_buf->write_index - read_buf->read_index;
         char *s = &read_buf->buf[read_buf->read_index];
         // the first 4 bytes is the length of the message
         if (readable < 4)